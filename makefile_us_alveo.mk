@@ -61,8 +61,18 @@ LDFLAGS += -L$(XILINX_XRT)/lib -pthread -lOpenCL
 PLATFORM_BLOCKLIST += u25_ u30 u200 zc vck u250 aws-vu9p-f1 samsung u2_ x3522pv nodma v70 
 ############################## Setting up Host Variables ##############################
 #Include Required Host Source Files
-CXXFLAGS += -I$(XF_PROJ_ROOT)
-HOST_SRCS += $(XF_PROJ_ROOT)/xcl2.cpp ./src/host.cpp 
+# The kernel code is also built into the host (CPU backend) and needs the
+# ap_int/hls_stream headers of Vitis HLS, or their open-source release
+HLS_INCLUDE ?= $(XILINX_HLS)/include
+CXXFLAGS += -I$(XF_PROJ_ROOT) -I$(HLS_INCLUDE)
+HOST_SRCS += $(XF_PROJ_ROOT)/xcl2.cpp ./src/host.cpp ./src/next_event.cpp ./src/state_patches.cpp ./src/event_cache.cpp ./src/event_frontier.cpp ./src/engine.cpp ./src/dem.cpp ./src/reorder.cpp ./src/dispatcher.cpp ./src/backend_cpu.cpp ./src/backend_opencl.cpp ./src/kernel_dataflow.cpp
+# Same host without XRT: only the CPU backends
+CPU_HOST_SRCS += ./src/host.cpp ./src/next_event.cpp ./src/state_patches.cpp ./src/event_cache.cpp ./src/event_frontier.cpp ./src/engine.cpp ./src/dem.cpp ./src/reorder.cpp ./src/dispatcher.cpp ./src/backend_cpu.cpp ./src/kernel_dataflow.cpp
+# Latency sweep over the backends; bench_device adds the XRT backend
+BENCH_SRCS += ./src/bench.cpp ./src/next_event.cpp ./src/reorder.cpp ./src/state_patches.cpp ./src/event_cache.cpp ./src/engine.cpp ./src/backend_cpu.cpp ./src/kernel_dataflow.cpp
+BENCH_DEVICE_SRCS += $(XF_PROJ_ROOT)/xcl2.cpp $(BENCH_SRCS) ./src/backend_opencl.cpp
+# CPU-only decoder, needs neither XRT nor an xclbin
+DECODER_SRCS += ./src/decode.cpp ./src/flooder.cpp ./src/arena.cpp ./src/next_event.cpp ./src/engine.cpp ./src/dispatcher.cpp
 # Host compiler global settings
 CXXFLAGS += -fmessage-length=0
 LDFLAGS += -lrt -lstdc++ 
@@ -70,11 +80,31 @@ LDFLAGS += -lrt -lstdc++
 ############################## Setting up Kernel Variables ##############################
 # Kernel compiler global settings
 VPP_FLAGS += --save-temps 
+# Width of the kernel's radius and time datapath (16, 32 or 64); the host
+# refuses graphs whose weights or radii need a wider one. The CPU backends run
+# the same kernel source, so the host is built with the same width.
+QUERK_TIME_BITS ?= 64
+VPP_FLAGS += -DQUERK_TIME_BITS=$(QUERK_TIME_BITS)
+CXXFLAGS += -DQUERK_TIME_BITS=$(QUERK_TIME_BITS)
+# Neighbor lanes the kernel evaluates per cycle (a power of two), for
+# high-degree graphs; the CPU backends follow it like QUERK_TIME_BITS.
+QUERK_NEIGHBOR_LANES ?= 1
+VPP_FLAGS += -DQUERK_NEIGHBOR_LANES=$(QUERK_NEIGHBOR_LANES)
+CXXFLAGS += -DQUERK_NEIGHBOR_LANES=$(QUERK_NEIGHBOR_LANES)
+# Candidate events returned per query (1 to 8); the result arrays of host and
+# kernel hold this many entries per query, so both use the same value.
+QUERK_TOP_K ?= 1
+VPP_FLAGS += -DQUERK_TOP_K=$(QUERK_TOP_K)
+CXXFLAGS += -DQUERK_TOP_K=$(QUERK_TOP_K)
 
 
 # Kernel linker flags
 VPP_LDFLAGS_querk += --config ./querk.cfg
 EXECUTABLE = ./querk_final
+DECODER = ./querk_decode
+CPU_HOST = ./querk_cpu
+BENCH = ./querk_bench
+BENCH_DEVICE = ./querk_bench_device
 EMCONFIG_DIR = $(TEMP_DIR)
 
 ############################## Setting Targets ##############################
@@ -84,17 +114,36 @@ all: check-platform check-device check-vitis $(EXECUTABLE) $(BUILD_DIR)/querk.xc
 .PHONY: host
 host: $(EXECUTABLE)
 
+.PHONY: decoder
+decoder: $(DECODER)
+
+.PHONY: host_cpu
+host_cpu: $(CPU_HOST)
+
+.PHONY: bench bench_device
+bench: $(BENCH)
+bench_device: $(BENCH_DEVICE)
+
 .PHONY: build
 build: check-vitis check-device $(BUILD_DIR)/querk.xclbin
 	
 .PHONY: xclbin
 xclbin: build
 
+# The free-running querk_stream kernel, for linking against a stream source
+# and sink (another kernel, or a host streaming platform)
+.PHONY: stream_xo
+stream_xo: $(TEMP_DIR)/querk_stream.xo
+
 ############################## Setting Rules for Binary Containers (Building Kernels) ##############################
 $(TEMP_DIR)/querk.xo: src/kernel_dataflow.cpp
 	mkdir -p $(TEMP_DIR)
 	v++ -c $(VPP_FLAGS) -t $(TARGET) --platform $(PLATFORM) -k querk --temp_dir $(TEMP_DIR)  -I'$(<D)' -o'$@' '$<'
 
+$(TEMP_DIR)/querk_stream.xo: src/kernel_dataflow.cpp
+	mkdir -p $(TEMP_DIR)
+	v++ -c $(VPP_FLAGS) -t $(TARGET) --platform $(PLATFORM) -k querk_stream --temp_dir $(TEMP_DIR)  -I'$(<D)' -o'$@' '$<'
+
 $(BUILD_DIR)/querk.xclbin: $(TEMP_DIR)/querk.xo
 	mkdir -p $(BUILD_DIR)
 	v++ -l $(VPP_FLAGS) $(VPP_LDFLAGS) -t $(TARGET) --platform $(PLATFORM) --temp_dir $(TEMP_DIR) $(VPP_LDFLAGS_querk) -o'$(LINK_OUTPUT)' $(+)
@@ -104,6 +153,18 @@ $(BUILD_DIR)/querk.xclbin: $(TEMP_DIR)/querk.xo
 $(EXECUTABLE): $(HOST_SRCS) | check-xrt
 		g++ -o $@ $^ $(CXXFLAGS) $(LDFLAGS)
 
+$(DECODER): $(DECODER_SRCS)
+		g++ -o $@ $^ $(CXXFLAGS) -O2 -pthread
+
+$(CPU_HOST): $(CPU_HOST_SRCS)
+		g++ -o $@ $^ $(CXXFLAGS) -DQUERK_CPU_ONLY -Wno-unknown-pragmas -O2 -pthread
+
+$(BENCH): $(BENCH_SRCS)
+		g++ -o $@ $^ $(CXXFLAGS) -DQUERK_CPU_ONLY -Wno-unknown-pragmas -O2 -pthread
+
+$(BENCH_DEVICE): $(BENCH_DEVICE_SRCS) | check-xrt
+		g++ -o $@ $^ $(CXXFLAGS) -Wno-unknown-pragmas -O2 $(LDFLAGS)
+
 emconfig:$(EMCONFIG_DIR)/emconfig.json
 $(EMCONFIG_DIR)/emconfig.json:
 	emconfigutil --platform $(PLATFORM) --od $(EMCONFIG_DIR)
@@ -128,7 +189,7 @@ endif
 ############################## Cleaning Rules ##############################
 # Cleaning stuff
 clean:
-	-$(RMDIR) $(EXECUTABLE) $(XCLBIN)/{*sw_emu*,*hw_emu*} 
+	-$(RMDIR) $(EXECUTABLE) $(DECODER) $(CPU_HOST) $(BENCH) $(BENCH_DEVICE) $(XCLBIN)/{*sw_emu*,*hw_emu*} 
 	-$(RMDIR) profile_* TempConfig system_estimate.xtxt *.rpt *.csv 
 	-$(RMDIR) src/*.ll *v++* .Xil emconfig.json dltmp* xmltmp* *.log *.jou *.wcfg *.wdb
 
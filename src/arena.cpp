@@ -0,0 +1,38 @@
+#include "arena.h"
+#include <algorithm>
+
+arena::arena()
+    : current(0),
+      offset(0),
+      used(0),
+      peak(0) {}
+
+void * arena::allocate(size_t bytes, size_t alignment) {
+    // Blocks come from new[], aligned for any fundamental type, so aligning the
+    // offset aligns the address. A request that does not fit moves on to the
+    // next block, adding one big enough at the end.
+    for (;;) {
+        if (current == blocks.size()) {
+            size_t size = std::max((size_t) ARENA_BLOCK_SIZE, bytes);
+            blocks.emplace_back(new uint8_t[size]);
+            block_sizes.push_back(size);
+        }
+        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= block_sizes[current]) {
+            offset = start + bytes;
+            used += bytes;
+            peak = std::max(peak, used);
+            return blocks[current].get() + start;
+        }
+        current++;
+        offset = 0;
+    }
+}
+
+size_t arena::capacity() const {
+    size_t total = 0;
+    for (size_t size : block_sizes) {
+        total += size;
+    }
+    return total;
+}
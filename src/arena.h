@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#define ARENA_BLOCK_SIZE (64u << 10)
+
+// Bump allocator for the scratch state of one shot, owned by one worker.
+// alloc() hands out uninitialized arrays of trivial types carved from a few
+// large blocks; reset() takes them all back in O(1) and keeps the blocks, so
+// once the first shots have grown it a worker decodes without touching the
+// heap. Arrays are aligned for their type only: buffers handed to the device
+// come from the backend (cl::Buffer), which keeps them page-aligned.
+struct arena {
+    std::vector<std::unique_ptr<uint8_t[]> > blocks;
+    std::vector<size_t> block_sizes;
+    // block being carved and the first free byte in it
+    size_t current;
+    size_t offset;
+    // bytes handed out since reset(), and the most over any shot
+    size_t used;
+    size_t peak;
+
+    arena();
+
+    template <typename T>
+    T * alloc(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void * allocate(size_t bytes, size_t alignment);
+    void reset() { current = 0; offset = 0; used = 0; }
+    size_t capacity() const;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include "state_patches.h"
+
+// Buffer sets per worker for submit_async(): one batch uploading, one running
+// and one reading back
+#define PIPELINE_DEPTH 3
+
+// Runs once the results of an async batch are in place, on a backend thread
+typedef std::function<void()> batch_callback;
+
+// The earliest event of a batch: the position of its query in detector_nodes,
+// and that query's neighbor, time and observables. query is -1 and time MAX
+// when no query of the batch has an event.
+struct batch_minimum {
+    uint32_t query;
+    uint32_t neighbor;
+    uint64_t time;
+    uint64_t observables;
+};
+
+// The graph and the host mirror of the dynamic arrays, in the layout of
+// next_event.h. The mirror is owned by the caller and written only through
+// state_patches, so a backend may keep pointing at it.
+struct backend_graph {
+    uint32_t num_nodes;
+    uint32_t num_regions;
+    uint32_t num_edges;
+    const uint32_t * neighbor_offsets;
+    const uint32_t * neighbors;
+    const uint32_t * neighbor_weights;
+    const uint64_t * neighbor_observables;
+    // the same edges as pack_edge_records() lays them out for the kernel
+    const edge_record * edges;
+
+    const uint64_t * radius;
+    const uint32_t * region_that_arrived_top;
+    const uint32_t * wrapped_radius_cached;
+    // packed records kept by state_patches::attach_node_states, or NULL to
+    // query the three arrays above
+    const node_state * node_states;
+};
+
+// Somewhere querk queries can run: the device, or the CPU. The host drives every
+// backend the same way:
+//   upload_graph() once,
+//   then per round update_state() with the patches recorded since the last
+//   round, followed by submit() and collect() for each batch, or by
+//   submit_async() for each batch and drain().
+// Batches of one round may be submitted from several dispatcher workers at once,
+// each with its own worker index below num_workers(); a worker always collects
+// its batch before submitting the next one.
+// Every call returns false after printing the reason on failure.
+struct backend {
+    virtual ~backend() {}
+
+    virtual const char * name() const = 0;
+    virtual uint32_t num_workers() const = 0;
+
+    // Makes the graph and the current dynamic arrays resident. max_batch bounds
+    // the num_queries of every later batch.
+    virtual bool upload_graph(const backend_graph & graph, uint32_t max_batch) = 0;
+    // Brings the backend's copy of the dynamic arrays up to date with the mirror.
+    virtual bool update_state(const state_patches & patches) = 0;
+    // Starts the next-event queries for detector_nodes[0 .. num_queries) on a worker.
+    virtual bool submit(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes) = 0;
+    // Waits for the worker's batch and copies its results out: the neighbor and
+    // time of each query's next event, and the observable mask of the edge it
+    // runs along (0 when there is none). Each array takes QUERK_TOP_K entries
+    // per query (querk_params.h), candidate j of query q at q*QUERK_TOP_K + j.
+    virtual bool collect(uint32_t worker, uint32_t num_queries, uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables) = 0;
+    // Region-scope query: submit() and collect() of a batch, typically the
+    // frontier of one region (state_patches::region_frontier), reduced to its
+    // earliest event where the queries run, so a single result comes back.
+    // Ties go to the earlier query.
+    virtual bool query_min(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes, batch_minimum & out) = 0;
+
+    // Asynchronous form of submit() + collect(). The upload of one batch, the
+    // run of the one before and the readback of the one before that overlap,
+    // each batch in one of pipeline_depth() buffer sets of the worker, and done
+    // is called once its results are in out_neighbor / out_time / out_observables. Blocks only
+    // while every buffer set of the worker is in flight. The batches of a worker
+    // complete in submission order; detector_nodes and the outputs must stay
+    // valid until done runs. drain() waits for all of the worker's batches.
+    // Neither update_state() nor the synchronous calls may be mixed in while
+    // batches are in flight.
+    virtual uint32_t pipeline_depth() const = 0;
+    virtual bool submit_async(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes,
+        uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables, batch_callback done) = 0;
+    virtual bool drain(uint32_t worker) = 0;
+};
+
+enum cpu_backend_mode {
+    // find_next_event_at_nodes_returning_neighbor_index_and_time
+    CPU_GOLDEN,
+    // engine_find_next_events with the widest ISA of this machine
+    CPU_ENGINE,
+    // the querk kernel itself (kernel_dataflow.cpp) compiled as plain C++ with
+    // the ap_int headers, fed from its own copy of the device arrays and patched
+    // through the kernel's own apply_patches. Its streams are static, so the
+    // kernel calls of all workers are serialized.
+    CPU_KERNEL,
+    // the free-running querk_stream, fed one command word per call as its C
+    // simulation testbench would. Needs the packed layout and a graph that
+    // fits on chip; serialized like CPU_KERNEL.
+    CPU_STREAM
+};
+
+const char * cpu_backend_mode_name(cpu_backend_mode mode);
+
+// Whether neighbor_offsets and edges fit the kernel's on-chip graph cache
+// (MAX_CACHED_NODES / MAX_CACHED_EDGES). Kernel backends built with
+// cache_graph load the graph on chip once in upload_graph() when it fits, and
+// read it from HBM on every batch otherwise.
+bool graph_fits_on_chip(const backend_graph & graph);
+
+// Whether the kernel's QUERK_TIME_BITS datapath answers exactly for edges up
+// to max_weight and local radii up to local_radius (time_bits_for in
+// next_event.h). Prints the reason when it does not. Kernel backends check it
+// in upload_graph() and, with the radius bound of the tracker, in update_state().
+bool kernel_time_bits_fit(uint32_t max_weight, uint64_t local_radius);
+
+// Stand-in for the PCIe link of a card, so the async pipeline has transfers to
+// overlap: every upload and readback of a CPU backend sleeps latency_us +
+// bytes / bytes_per_us. The default (all zero) moves data as plain copies.
+struct cpu_link_model {
+    double latency_us;
+    double bytes_per_us;
+
+    cpu_link_model() : latency_us(0), bytes_per_us(0) {}
+};
+
+// With narrow_time CPU_ENGINE runs every batch on the narrowest datapath
+// time_bits_for() allows for the graph and the tracker's radius bound; without
+// it the engine always computes in 64 bits.
+backend * make_cpu_backend(cpu_backend_mode mode, uint32_t num_threads, bool cache_graph = true, cpu_link_model link = cpu_link_model(),
+    bool narrow_time = true);
+
+// One worker per compute unit querk_1 .. querk_<num_cus> of the xclbin, each
+// with its ports on BANKS_PER_CU consecutive HBM banks. Returns NULL when no
+// device can be programmed.
+backend * make_opencl_backend(const std::string & xclbin, uint32_t num_cus, bool cache_graph = true);
+
+#endif
@@ -0,0 +1,533 @@
+#include "backend.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ap_int.h"
+#include "kernel_simple.h"
+#include "next_event.h"
+#include "engine.h"
+
+namespace {
+
+// One buffer set: what would be the device copy of a batch, with
+// QUERK_TOP_K results per query
+struct cpu_slot {
+    std::vector<uint32_t> detector_nodes;
+    std::vector<uint32_t> out_neighbor;
+    std::vector<uint64_t> out_time;
+    std::vector<uint64_t> out_observables;
+
+    // CPU_KERNEL only: the kernel's view of the batch
+    std::vector<ap_uint<32> > kernel_detector_nodes;
+    std::vector<ap_uint<32> > kernel_out_neighbor;
+    std::vector<ap_uint<64> > kernel_out_time;
+    std::vector<ap_uint<64> > kernel_out_observables;
+
+    void resize(uint32_t max_batch, bool kernel) {
+        detector_nodes.resize(max_batch);
+        out_neighbor.resize(max_batch*QUERK_TOP_K);
+        out_time.resize(max_batch*QUERK_TOP_K);
+        out_observables.resize(max_batch*QUERK_TOP_K);
+        if (kernel) {
+            kernel_detector_nodes.resize(max_batch);
+            kernel_out_neighbor.resize(max_batch*QUERK_TOP_K);
+            kernel_out_time.resize(max_batch*QUERK_TOP_K);
+            kernel_out_observables.resize(max_batch*QUERK_TOP_K);
+        }
+    }
+};
+
+// An async batch on its way through upload -> run -> readback
+struct cpu_request {
+    cpu_slot * slot;
+    uint32_t num_queries;
+    const uint32_t * detector_nodes;
+    uint32_t * out_neighbor;
+    uint64_t * out_time;
+    uint64_t * out_observables;
+    batch_callback done;
+};
+
+// FIFO between two pipeline stages; pop() returns false once stopped and empty
+struct cpu_stage {
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<cpu_request> requests;
+    bool stopping;
+
+    cpu_stage() : stopping(false) {}
+
+    void push(const cpu_request & request) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            requests.push_back(request);
+        }
+        ready.notify_one();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+    }
+
+    bool pop(cpu_request & request) {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this] { return stopping || !requests.empty(); });
+        if (requests.empty()) {
+            return false;
+        }
+        request = requests.front();
+        requests.pop_front();
+        return true;
+    }
+};
+
+struct cpu_worker {
+    // the batch between submit() and collect()
+    cpu_slot batch;
+
+    // async pipeline: PIPELINE_DEPTH buffer sets used round-robin, and one
+    // thread per stage, started by the first submit_async()
+    cpu_slot slots[PIPELINE_DEPTH];
+    uint32_t next_slot;
+    uint32_t in_flight;
+    std::mutex lock;
+    std::condition_variable slot_free;
+    cpu_stage upload;
+    cpu_stage run;
+    cpu_stage readback;
+    std::vector<std::thread> threads;
+
+    cpu_worker() : next_slot(0), in_flight(0) {}
+};
+
+struct cpu_backend : backend {
+    cpu_backend_mode mode;
+    engine_isa isa;
+    std::string full_name;
+    backend_graph graph;
+    cpu_link_model link;
+    std::vector<std::unique_ptr<cpu_worker> > workers;
+    // what the datapath width is chosen from
+    bool narrow_time;
+    uint32_t max_weight;
+    uint64_t local_radius;
+
+    // CPU_KERNEL only: what would be device memory, and the patches the next
+    // kernel call applies
+    std::vector<ap_uint<32> > neighbor_offsets;
+    std::vector<ap_uint<128> > edges;
+    std::vector<ap_uint<64> > radius;
+    std::vector<ap_uint<32> > region_that_arrived_top;
+    std::vector<ap_uint<32> > wrapped_radius_cached;
+    std::vector<ap_uint<128> > node_states;
+    std::vector<ap_uint<64> > patches;
+    uint32_t pending_patches;
+    bool cache_graph;
+    // GRAPH_CACHED once the graph is on chip, else GRAPH_HBM
+    uint32_t graph_mode;
+    std::mutex kernel_lock;
+
+    // CPU_STREAM only: the two AXI4-Streams of querk_stream
+    hls::stream<ap_uint<128> > commands;
+    hls::stream<ap_uint<128> > results;
+
+    cpu_backend(cpu_backend_mode mode, uint32_t num_threads, bool cache_graph, const cpu_link_model & link, bool narrow_time)
+        : mode(mode), isa(mode == CPU_ENGINE ? engine_detect() : ENGINE_SCALAR), link(link),
+          narrow_time(narrow_time), max_weight(0), local_radius(0), patches(2*MAX_PATCHES), pending_patches(0), cache_graph(cache_graph), graph_mode(GRAPH_HBM) {
+        for (uint32_t w = 0; w < num_threads; w++) {
+            workers.emplace_back(new cpu_worker());
+        }
+        full_name = std::string("cpu-") + cpu_backend_mode_name(mode);
+        if (mode == CPU_ENGINE) {
+            full_name += std::string("-") + engine_isa_name(isa);
+        }
+        if (mode == CPU_ENGINE && !narrow_time) {
+            full_name += "-wide";
+        }
+        if (mode == CPU_KERNEL && !cache_graph) {
+            full_name += "-hbm";
+        }
+    }
+
+    ~cpu_backend() {
+        for (size_t w = 0; w < workers.size(); w++) {
+            cpu_worker & cw = *workers[w];
+            cw.upload.stop();
+            cw.run.stop();
+            cw.readback.stop();
+            for (size_t t = 0; t < cw.threads.size(); t++) {
+                cw.threads[t].join();
+            }
+        }
+    }
+
+    const char * name() const { return full_name.c_str(); }
+    uint32_t num_workers() const { return workers.size(); }
+    uint32_t pipeline_depth() const { return PIPELINE_DEPTH; }
+
+    // Time a transfer of this size would spend on the modelled link
+    void link_transfer(size_t bytes) const {
+        if (link.latency_us == 0 && link.bytes_per_us == 0) {
+            return;
+        }
+        double us = link.latency_us + (link.bytes_per_us > 0 ? bytes / link.bytes_per_us : 0);
+        std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(us));
+    }
+
+    void copy_dynamic_arrays() {
+        std::copy(graph.radius, graph.radius + graph.num_regions, radius.begin());
+        std::copy(graph.region_that_arrived_top, graph.region_that_arrived_top + graph.num_nodes, region_that_arrived_top.begin());
+        std::copy(graph.wrapped_radius_cached, graph.wrapped_radius_cached + graph.num_nodes, wrapped_radius_cached.begin());
+        for (uint32_t n = 0; graph.node_states != NULL && n < graph.num_nodes; n++) {
+            ap_uint<128> record = graph.node_states[n].radius;
+            record.range(95,64) = graph.node_states[n].region;
+            node_states[n] = record;
+        }
+    }
+
+    static ap_uint<128> command(uint32_t target, uint32_t index, uint64_t value) {
+        ap_uint<128> word = value;
+        word.range(127,96) = target;
+        word.range(95,64) = index;
+        return word;
+    }
+
+    // The free-running kernel takes one command per iteration; in C simulation
+    // an iteration is a call. Caller holds kernel_lock.
+    void run_stream() {
+        while (!commands.empty()) {
+            querk_stream(commands, results);
+        }
+    }
+
+    // The graph and every node record go down the command stream once
+    bool upload_stream() {
+        if (!graph_fits_on_chip(graph) || graph.node_states == NULL) {
+            printf("Error: the stream kernel needs the packed layout and a graph within %u nodes and %u edges\n", MAX_CACHED_NODES, MAX_CACHED_EDGES);
+            return false;
+        }
+        if (QUERK_TOP_K > 1) {
+            printf("Error: the stream kernel returns one candidate per query, build with QUERK_TOP_K=1\n");
+            return false;
+        }
+        std::lock_guard<std::mutex> guard(kernel_lock);
+        for (uint32_t n = 0; n <= graph.num_nodes; n++) {
+            commands << command(STREAM_GRAPH_OFFSET, n, graph.neighbor_offsets[n]);
+        }
+        for (uint32_t e = 0; e < graph.num_edges; e++) {
+            commands << command(STREAM_GRAPH_EDGE, e, (uint64_t) graph.edges[e].weight << 32 | graph.edges[e].neighbor);
+        }
+        for (uint32_t n = 0; n < graph.num_nodes; n++) {
+            commands << command(PATCH_NODE_RADIUS, n, graph.node_states[n].radius);
+            commands << command(PATCH_NODE_REGION, n, graph.node_states[n].region);
+        }
+        run_stream();
+        return true;
+    }
+
+    bool is_kernel() const { return mode == CPU_KERNEL || mode == CPU_STREAM; }
+
+    uint32_t time_bits() const {
+        return narrow_time ? time_bits_for(max_weight, local_radius) : 64;
+    }
+
+    bool upload_graph(const backend_graph & g, uint32_t max_batch) {
+        graph = g;
+        max_weight = max_edge_weight(graph.num_edges, graph.neighbor_weights);
+        local_radius = max_local_radius(graph.num_nodes, graph.num_regions, graph.wrapped_radius_cached, graph.radius);
+        if (is_kernel() && !kernel_time_bits_fit(max_weight, local_radius)) {
+            return false;
+        }
+        for (size_t w = 0; w < workers.size(); w++) {
+            // query_min() gets the kernel's winning position in a second slot
+            workers[w]->batch.resize(std::max(max_batch, 2u), mode == CPU_KERNEL);
+            for (uint32_t s = 0; s < PIPELINE_DEPTH; s++) {
+                workers[w]->slots[s].resize(max_batch, mode == CPU_KERNEL);
+            }
+        }
+        if (mode == CPU_STREAM) {
+            return upload_stream();
+        }
+        if (mode != CPU_KERNEL) {
+            // golden and engine read the host mirror directly
+            return true;
+        }
+        neighbor_offsets.assign(graph.neighbor_offsets, graph.neighbor_offsets + graph.num_nodes + 1);
+        edges.resize(graph.num_edges);
+        for (uint32_t e = 0; e < graph.num_edges; e++) {
+            ap_uint<128> record = graph.edges[e].neighbor;
+            record.range(63,32) = graph.edges[e].weight;
+            record.range(127,64) = graph.edges[e].observables;
+            edges[e] = record;
+        }
+        radius.resize(graph.num_regions);
+        region_that_arrived_top.resize(graph.num_nodes);
+        wrapped_radius_cached.resize(graph.num_nodes);
+        // the kernel needs a valid pointer even when it does not read the records
+        node_states.resize(graph.node_states != NULL ? graph.num_nodes : 1);
+        copy_dynamic_arrays();
+
+        graph_mode = GRAPH_HBM;
+        if (cache_graph && graph_fits_on_chip(graph)) {
+            // the init call: no queries, no patches, just the copy on chip
+            cpu_slot & slot = workers[0]->batch;
+            querk(0, slot.kernel_detector_nodes.data(), 0, patches.data(), graph.num_nodes, graph.num_regions,
+                neighbor_offsets.data(), radius.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(),
+                edges.data(), slot.kernel_out_neighbor.data(), slot.kernel_out_time.data(),
+                node_states.data(), graph.node_states != NULL, GRAPH_LOAD, slot.kernel_out_observables.data(), 0);
+            graph_mode = GRAPH_CACHED;
+        } else if (cache_graph) {
+            printf("Graph of %u nodes and %u edges exceeds the on-chip cache, reading it from memory\n", graph.num_nodes, graph.num_edges);
+        }
+        return true;
+    }
+
+    bool update_state(const state_patches & p) {
+        local_radius = std::max(local_radius, p.local_radius_bound());
+        if (is_kernel() && !kernel_time_bits_fit(max_weight, local_radius)) {
+            return false;
+        }
+        if (mode == CPU_STREAM) {
+            // the packed tracker only ever emits record patches, which the
+            // stream takes as they are
+            std::lock_guard<std::mutex> guard(kernel_lock);
+            for (uint32_t i = 0; i < p.size(); i++) {
+                ap_uint<128> word = p.words[2*i + 1];
+                word.range(127,64) = p.words[2*i];
+                commands << word;
+            }
+            run_stream();
+            return true;
+        }
+        if (mode != CPU_KERNEL) {
+            return true;
+        }
+        // Patches not applied by a kernel call yet are covered by the full copy too
+        if (p.size() > MAX_PATCHES || pending_patches > 0) {
+            copy_dynamic_arrays();
+            pending_patches = 0;
+            return true;
+        }
+        std::copy(p.words.begin(), p.words.end(), patches.begin());
+        pending_patches = p.size();
+        return true;
+    }
+
+    // Answers a batch into the slot's outputs; the kernel reduces it to slot 0
+    // with reduce_min, the other modes ignore it and leave that to query_min()
+    void run_batch(cpu_slot & slot, uint32_t num_queries, const uint32_t * detector_nodes, bool reduce_min = false) {
+        // const_cast: the reference functions take plain pointers but only read them
+        uint32_t * nodes = const_cast<uint32_t *>(detector_nodes);
+        uint32_t * offsets = const_cast<uint32_t *>(graph.neighbor_offsets);
+        uint32_t * nbrs = const_cast<uint32_t *>(graph.neighbors);
+        uint32_t * weights = const_cast<uint32_t *>(graph.neighbor_weights);
+        uint32_t * rtat = const_cast<uint32_t *>(graph.region_that_arrived_top);
+        uint32_t * wrc = const_cast<uint32_t *>(graph.wrapped_radius_cached);
+        uint64_t * rad = const_cast<uint64_t *>(graph.radius);
+
+        if (QUERK_TOP_K > 1 && !is_kernel()) {
+            // the engine has no top-k path, golden and engine both list candidates here
+            if (graph.node_states != NULL) {
+                find_next_events_top_k_packed(QUERK_TOP_K, num_queries, nodes, offsets, graph.edges, graph.node_states, slot.out_neighbor.data(), slot.out_time.data());
+            } else {
+                find_next_events_top_k(QUERK_TOP_K, num_queries, nodes, offsets, nbrs, weights, rtat, wrc, rad, slot.out_neighbor.data(), slot.out_time.data());
+            }
+        } else if (mode == CPU_GOLDEN && graph.node_states != NULL) {
+            find_next_event_at_nodes_packed_returning_neighbor_index_and_time(num_queries, nodes, offsets, graph.edges, graph.node_states, slot.out_neighbor.data(), slot.out_time.data());
+        } else if (mode == CPU_GOLDEN) {
+            find_next_event_at_nodes_returning_neighbor_index_and_time(num_queries, nodes, offsets, nbrs, weights, rtat, wrc, rad, slot.out_neighbor.data(), slot.out_time.data());
+        } else if (mode == CPU_ENGINE && graph.node_states != NULL) {
+            engine_find_next_events_packed(isa, time_bits(), num_queries, nodes, offsets, graph.edges, graph.node_states, slot.out_neighbor.data(), slot.out_time.data());
+        } else if (mode == CPU_ENGINE) {
+            engine_find_next_events(isa, time_bits(), num_queries, nodes, offsets, nbrs, weights, rtat, wrc, rad, slot.out_neighbor.data(), slot.out_time.data());
+        } else if (mode == CPU_STREAM) {
+            std::lock_guard<std::mutex> guard(kernel_lock);
+            for (uint32_t q = 0; q < num_queries; q++) {
+                commands << command(STREAM_QUERY, detector_nodes[q], 0);
+            }
+            run_stream();
+            // one result per query, in order
+            for (uint32_t q = 0; q < num_queries; q++) {
+                ap_uint<128> result = results.read();
+                slot.out_neighbor[q] = result.range(95,64);
+                slot.out_time[q] = result.range(63,0);
+            }
+        } else {
+            std::copy(detector_nodes, detector_nodes + num_queries, slot.kernel_detector_nodes.begin());
+            std::lock_guard<std::mutex> guard(kernel_lock);
+            querk(num_queries, slot.kernel_detector_nodes.data(), pending_patches, patches.data(), graph.num_nodes, graph.num_regions,
+                neighbor_offsets.data(), radius.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(),
+                edges.data(), slot.kernel_out_neighbor.data(), slot.kernel_out_time.data(),
+                node_states.data(), graph.node_states != NULL, graph_mode, slot.kernel_out_observables.data(), reduce_min);
+            pending_patches = 0;
+            return;
+        }
+        // everything but the kernel looks the winning edges' observables up here,
+        // as part of the batch, so they come back with the rest of the results
+        if (graph.node_states != NULL) {
+            find_next_event_observables_packed(num_queries, nodes, offsets, graph.edges, slot.out_neighbor.data(), slot.out_observables.data(), QUERK_TOP_K);
+        } else {
+            find_next_event_observables(num_queries, nodes, offsets, graph.neighbor_observables, slot.out_neighbor.data(), slot.out_observables.data(), QUERK_TOP_K);
+        }
+    }
+
+    void copy_results(const cpu_slot & slot, uint32_t num_queries, uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables) const {
+        num_queries *= QUERK_TOP_K;
+        if (mode == CPU_KERNEL) {
+            for (uint32_t q = 0; q < num_queries; q++) {
+                out_neighbor[q] = slot.kernel_out_neighbor[q];
+                out_time[q] = slot.kernel_out_time[q];
+                out_observables[q] = slot.kernel_out_observables[q];
+            }
+        } else {
+            std::copy(slot.out_neighbor.begin(), slot.out_neighbor.begin() + num_queries, out_neighbor);
+            std::copy(slot.out_time.begin(), slot.out_time.begin() + num_queries, out_time);
+            std::copy(slot.out_observables.begin(), slot.out_observables.begin() + num_queries, out_observables);
+        }
+    }
+
+    bool submit(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes) {
+        link_transfer(sizeof(uint32_t)*num_queries);
+        run_batch(workers[worker]->batch, num_queries, detector_nodes);
+        return true;
+    }
+
+    bool collect(uint32_t worker, uint32_t num_queries, uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables) {
+        link_transfer((sizeof(uint32_t) + 2*sizeof(uint64_t))*QUERK_TOP_K*num_queries);
+        copy_results(workers[worker]->batch, num_queries, out_neighbor, out_time, out_observables);
+        return true;
+    }
+
+    bool query_min(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes, batch_minimum & out) {
+        cpu_slot & slot = workers[worker]->batch;
+        link_transfer(sizeof(uint32_t)*num_queries);
+        run_batch(slot, num_queries, detector_nodes, true);
+        link_transfer(2*sizeof(uint32_t) + 2*sizeof(uint64_t));
+        if (mode == CPU_KERNEL) {
+            out.neighbor = slot.kernel_out_neighbor[0];
+            out.query = slot.kernel_out_neighbor[1];
+            out.time = slot.kernel_out_time[0];
+            out.observables = slot.kernel_out_observables[0];
+            return true;
+        }
+        // the CPU modes reduce their own results, the first candidate of each
+        // query; querk_stream has no reduction and answers every query
+        out = {(uint32_t) -1, (uint32_t) -1, (uint64_t) MAX, 0};
+        for (uint32_t q = 0; q < num_queries; q++) {
+            uint32_t first = q*QUERK_TOP_K;
+            if (slot.out_time[first] < out.time) {
+                out = {q, slot.out_neighbor[first], slot.out_time[first], slot.out_observables[first]};
+            }
+        }
+        return true;
+    }
+
+    // The three stages of a worker's pipeline, each on its own thread
+    void upload_stage(cpu_worker & cw) {
+        cpu_request request;
+        while (cw.upload.pop(request)) {
+            link_transfer(sizeof(uint32_t)*request.num_queries);
+            std::copy(request.detector_nodes, request.detector_nodes + request.num_queries, request.slot->detector_nodes.begin());
+            cw.run.push(request);
+        }
+    }
+
+    void run_stage(cpu_worker & cw) {
+        cpu_request request;
+        while (cw.run.pop(request)) {
+            run_batch(*request.slot, request.num_queries, request.slot->detector_nodes.data());
+            cw.readback.push(request);
+        }
+    }
+
+    void readback_stage(cpu_worker & cw) {
+        cpu_request request;
+        while (cw.readback.pop(request)) {
+            link_transfer((sizeof(uint32_t) + 2*sizeof(uint64_t))*QUERK_TOP_K*request.num_queries);
+            copy_results(*request.slot, request.num_queries, request.out_neighbor, request.out_time, request.out_observables);
+            if (request.done) {
+                request.done();
+            }
+            {
+                std::lock_guard<std::mutex> guard(cw.lock);
+                cw.in_flight--;
+            }
+            cw.slot_free.notify_all();
+        }
+    }
+
+    bool submit_async(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes,
+        uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables, batch_callback done) {
+        cpu_worker & cw = *workers[worker];
+        if (cw.threads.empty()) {
+            cw.threads.emplace_back(&cpu_backend::upload_stage, this, std::ref(cw));
+            cw.threads.emplace_back(&cpu_backend::run_stage, this, std::ref(cw));
+            cw.threads.emplace_back(&cpu_backend::readback_stage, this, std::ref(cw));
+        }
+
+        cpu_request request;
+        {
+            // batches complete in order, so the next slot round-robin is the
+            // oldest one and free as soon as fewer than PIPELINE_DEPTH are in flight
+            std::unique_lock<std::mutex> guard(cw.lock);
+            cw.slot_free.wait(guard, [&cw] { return cw.in_flight < PIPELINE_DEPTH; });
+            cw.in_flight++;
+            request.slot = &cw.slots[cw.next_slot];
+            cw.next_slot = (cw.next_slot + 1) % PIPELINE_DEPTH;
+        }
+        request.num_queries = num_queries;
+        request.detector_nodes = detector_nodes;
+        request.out_neighbor = out_neighbor;
+        request.out_time = out_time;
+        request.out_observables = out_observables;
+        request.done = done;
+        cw.upload.push(request);
+        return true;
+    }
+
+    bool drain(uint32_t worker) {
+        cpu_worker & cw = *workers[worker];
+        std::unique_lock<std::mutex> guard(cw.lock);
+        cw.slot_free.wait(guard, [&cw] { return cw.in_flight == 0; });
+        return true;
+    }
+};
+
+}
+
+const char * cpu_backend_mode_name(cpu_backend_mode mode) {
+    switch (mode) {
+        case CPU_GOLDEN: return "golden";
+        case CPU_ENGINE: return "engine";
+        case CPU_STREAM: return "stream";
+        default: return "kernel";
+    }
+}
+
+bool graph_fits_on_chip(const backend_graph & graph) {
+    return graph.num_nodes <= MAX_CACHED_NODES && graph.num_edges <= MAX_CACHED_EDGES;
+}
+
+bool kernel_time_bits_fit(uint32_t max_weight, uint64_t local_radius) {
+    uint32_t bits = time_bits_for(max_weight, local_radius);
+    if (bits > QUERK_TIME_BITS) {
+        printf("Error: weights up to %u and local radii up to %lu need a %u-bit datapath, the kernel is built with QUERK_TIME_BITS=%d\n",
+            max_weight, (unsigned long) local_radius, bits, QUERK_TIME_BITS);
+        return false;
+    }
+    return true;
+}
+
+backend * make_cpu_backend(cpu_backend_mode mode, uint32_t num_threads, bool cache_graph, cpu_link_model link, bool narrow_time) {
+    return new cpu_backend(mode, num_threads, cache_graph, link, narrow_time);
+}
@@ -0,0 +1,486 @@
+#include "backend.h"
+#include "xcl2.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define BANKS_PER_CU 10
+
+#define MAX_HBM_BANKCOUNT 32
+#define BANK_NAME(n) n | XCL_MEM_TOPOLOGY
+const int bank[MAX_HBM_BANKCOUNT] = {
+    BANK_NAME(0),  BANK_NAME(1),  BANK_NAME(2),  BANK_NAME(3),  BANK_NAME(4),
+    BANK_NAME(5),  BANK_NAME(6),  BANK_NAME(7),  BANK_NAME(8),  BANK_NAME(9),
+    BANK_NAME(10), BANK_NAME(11), BANK_NAME(12), BANK_NAME(13), BANK_NAME(14),
+    BANK_NAME(15), BANK_NAME(16), BANK_NAME(17), BANK_NAME(18), BANK_NAME(19),
+    BANK_NAME(20), BANK_NAME(21), BANK_NAME(22), BANK_NAME(23), BANK_NAME(24),
+    BANK_NAME(25), BANK_NAME(26), BANK_NAME(27), BANK_NAME(28), BANK_NAME(29),
+    BANK_NAME(30), BANK_NAME(31)};
+
+namespace {
+
+// The per-batch buffers of one stage of a CU's async pipeline
+struct pipeline_slot {
+    cl::Buffer detector_nodes_buffer;
+    cl::Buffer out_neighbor_buffer;
+    cl::Buffer out_time_buffer;
+    cl::Buffer out_observables_buffer;
+    // between submit_async() and the batch's completion callback
+    bool busy;
+};
+
+// One querk compute unit: its own kernel object, in-order command queue and
+// buffer set. Only the dispatcher worker that owns the CU touches it.
+struct compute_unit {
+    cl::Kernel krnl;
+    cl::CommandQueue commands;
+    // out of order: submit_async() orders each batch through event dependencies
+    // only, so one batch's write and read can overlap the next one's run
+    cl::CommandQueue pipeline;
+    cl::Buffer neighbor_offsets_buffer;
+    cl::Buffer radius_buffer;
+    cl::Buffer region_that_arrived_top_buffer;
+    cl::Buffer wrapped_radius_cached_buffer;
+    cl::Buffer edges_buffer;
+    cl::Buffer out_neighbor_buffer;
+    cl::Buffer out_time_buffer;
+    cl::Buffer out_observables_buffer;
+    cl::Buffer detector_nodes_buffer;
+    cl::Buffer patches_buffer;
+    cl::Buffer node_states_buffer;
+
+    // patches sitting in patches_buffer that the CU has not applied yet
+    uint32_t pending_patches;
+    // missed some patches: the next batch resends the dynamic arrays whole
+    bool stale;
+
+    pipeline_slot slots[PIPELINE_DEPTH];
+    uint32_t next_slot;
+    // the last kernel run of the pipeline; every run waits for the one before,
+    // which applied patches the next one sees
+    cl::Event last_run;
+    std::mutex lock;
+    std::condition_variable slot_free;
+    bool failed;
+};
+
+// What the completion callback of an async batch needs
+struct pipeline_batch {
+    compute_unit * cu;
+    uint32_t worker;
+    uint32_t slot;
+    batch_callback done;
+};
+
+void CL_CALLBACK batch_complete(cl_event, cl_int status, void * data) {
+    pipeline_batch * batch = (pipeline_batch *) data;
+    compute_unit & cu = *batch->cu;
+    if (status != CL_COMPLETE) {
+        printf("Error: Batch on CU(%u) failed! %d\n", batch->worker + 1, status);
+    } else if (batch->done) {
+        batch->done();
+    }
+    {
+        std::lock_guard<std::mutex> guard(cu.lock);
+        cu.slots[batch->slot].busy = false;
+        cu.failed = cu.failed || status != CL_COMPLETE;
+    }
+    cu.slot_free.notify_all();
+    delete batch;
+}
+
+struct opencl_backend : backend {
+    cl::Context context;
+    cl::Device device;
+    cl::Program program;
+    std::vector<std::unique_ptr<compute_unit> > cus;
+    backend_graph graph;
+    bool cache_graph;
+    uint32_t max_weight;
+    uint64_t local_radius;
+
+    const char * name() const { return "opencl"; }
+    uint32_t num_workers() const { return cus.size(); }
+    uint32_t pipeline_depth() const { return PIPELINE_DEPTH; }
+
+    bool program_device(const std::string & binaryFile) {
+        cl_int err;
+
+        // The get_xil_devices will return vector of Xilinx Devices
+        auto devices = xcl::get_xil_devices();
+
+        // read_binary_file() command will find the OpenCL binary file created using the
+        // V++ compiler load into OpenCL Binary and return pointer to file buffer.
+        auto fileBuf = xcl::read_binary_file(binaryFile);
+
+        cl::Program::Binaries bins{{fileBuf.data(), fileBuf.size()}};
+
+        for (unsigned int i = 0; i < devices.size(); i++) {
+            device = devices[i];
+            // Creating Context for selected Device
+            OCL_CHECK(err, context = cl::Context(device, NULL, NULL, NULL, &err));
+
+            std::cout << "Trying to program device[" << i
+                      << "]: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
+
+            program = cl::Program(context, {device}, bins, NULL, &err);
+
+            if (err != CL_SUCCESS) {
+                std::cout << "Failed to program device[" << i
+                            << "] with xclbin file!\n";
+            } else {
+                std::cout << "Device[" << i << "]: program successful!\n";
+                return true;
+            }
+        }
+
+        std::cout << "Failed to program any device found, exit!\n";
+        return false;
+    }
+
+    bool create_compute_units(uint32_t num_cus) {
+        cl_int err;
+        if (num_cus * BANKS_PER_CU > MAX_HBM_BANKCOUNT) {
+            printf("Error: %u compute units need more than %d HBM banks\n", num_cus, MAX_HBM_BANKCOUNT);
+            return false;
+        }
+        for (uint32_t c = 0; c < num_cus; c++) {
+            cus.emplace_back(new compute_unit());
+            compute_unit & cu = *cus[c];
+            int b = c*BANKS_PER_CU;
+
+            //Here Kernel object is created by specifying kernel name along with compute unit.
+            //For such case, this kernel object can only access the specific Compute unit
+            std::string krnl_name_full = "querk:{querk_" + std::to_string(c + 1) + "}";
+            printf("Creating a kernel [%s] for CU(%u) on HBM[%d..%d]\n", krnl_name_full.c_str(), c + 1, b, b + BANKS_PER_CU - 1);
+            OCL_CHECK(err, cu.krnl = cl::Kernel(program, krnl_name_full.c_str(), &err));
+            // in order: each batch is write, run, read back
+            OCL_CHECK(err, cu.commands = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err));
+            OCL_CHECK(err, cu.pipeline = cl::CommandQueue(context, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE, &err));
+            cu.pending_patches = 0;
+            cu.stale = false;
+            for (uint32_t s = 0; s < PIPELINE_DEPTH; s++) {
+                cu.slots[s].busy = false;
+            }
+            cu.next_slot = 0;
+            cu.failed = false;
+        }
+        std::cout << "Kernels created" << std::endl;
+        return true;
+    }
+
+    // Device buffers are allocated by XRT on the CU's banks and filled by
+    // explicit writes, so several CUs can hold copies of the same host array.
+    cl::Buffer device_buffer(cl_mem_flags flags, int bank_index, size_t size) {
+        cl_int err;
+        cl_mem_ext_ptr_t ext;
+        ext.obj = NULL;
+        ext.param = 0;
+        ext.flags = bank[bank_index];
+        cl::Buffer buffer;
+        OCL_CHECK(err, buffer = cl::Buffer(context, flags | CL_MEM_EXT_PTR_XILINX, size, &ext, &err));
+        return buffer;
+    }
+
+    // Enqueues the writes on queue, with one event per write appended to written
+    cl_int write_dynamic_arrays(compute_unit & cu, cl::CommandQueue & queue, std::vector<cl::Event> & written) {
+        size_t first = written.size();
+        written.resize(first + (graph.node_states != NULL ? 4 : 3));
+        cl_int err = queue.enqueueWriteBuffer(cu.radius_buffer, CL_FALSE, 0, sizeof(long int)*graph.num_regions, graph.radius, NULL, &written[first]);
+        if (err == CL_SUCCESS) err = queue.enqueueWriteBuffer(cu.region_that_arrived_top_buffer, CL_FALSE, 0, sizeof(int)*graph.num_nodes, graph.region_that_arrived_top, NULL, &written[first + 1]);
+        if (err == CL_SUCCESS) err = queue.enqueueWriteBuffer(cu.wrapped_radius_cached_buffer, CL_FALSE, 0, sizeof(int)*graph.num_nodes, graph.wrapped_radius_cached, NULL, &written[first + 2]);
+        if (err == CL_SUCCESS && graph.node_states != NULL) err = queue.enqueueWriteBuffer(cu.node_states_buffer, CL_FALSE, 0, sizeof(node_state)*graph.num_nodes, graph.node_states, NULL, &written[first + 3]);
+        return err;
+    }
+
+    bool upload_graph(const backend_graph & g, uint32_t max_batch) {
+        cl_int err;
+        graph = g;
+        max_weight = max_edge_weight(graph.num_edges, graph.neighbor_weights);
+        local_radius = max_local_radius(graph.num_nodes, graph.num_regions, graph.wrapped_radius_cached, graph.radius);
+        if (!kernel_time_bits_fit(max_weight, local_radius)) {
+            return false;
+        }
+        for (uint32_t c = 0; c < cus.size(); c++) {
+            compute_unit & cu = *cus[c];
+            int b = c*BANKS_PER_CU;
+
+            cu.neighbor_offsets_buffer = device_buffer(CL_MEM_READ_ONLY, b + 0, sizeof(int)*(graph.num_nodes + 1));
+            cu.radius_buffer = device_buffer(CL_MEM_READ_WRITE, b + 1, sizeof(long int)*graph.num_regions);
+            cu.region_that_arrived_top_buffer = device_buffer(CL_MEM_READ_WRITE, b + 2, sizeof(int)*graph.num_nodes);
+            cu.wrapped_radius_cached_buffer = device_buffer(CL_MEM_READ_WRITE, b + 3, sizeof(int)*graph.num_nodes);
+            cu.edges_buffer = device_buffer(CL_MEM_READ_ONLY, b + 4, sizeof(edge_record)*graph.num_edges);
+            // query_min() gets the winning position in a second slot
+            cu.out_neighbor_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 5, sizeof(int)*std::max(max_batch*QUERK_TOP_K, 2u));
+            cu.out_time_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 6, sizeof(long int)*max_batch*QUERK_TOP_K);
+            // shares out_time's bank: three CUs of BANKS_PER_CU already take 30 of 32
+            cu.out_observables_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 6, sizeof(long int)*max_batch*QUERK_TOP_K);
+            cu.detector_nodes_buffer = device_buffer(CL_MEM_READ_ONLY, b + 7, sizeof(int)*max_batch);
+            cu.patches_buffer = device_buffer(CL_MEM_READ_ONLY, b + 8, sizeof(long int)*2*MAX_PATCHES);
+            // one record even for the split layout, the kernel argument must be a buffer
+            cu.node_states_buffer = device_buffer(CL_MEM_READ_WRITE, b + 9, sizeof(node_state)*(graph.node_states != NULL ? graph.num_nodes : 1));
+            // the pipeline's buffer sets share the banks of the synchronous ones
+            for (uint32_t s = 0; s < PIPELINE_DEPTH; s++) {
+                pipeline_slot & slot = cu.slots[s];
+                slot.out_neighbor_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 5, sizeof(int)*max_batch*QUERK_TOP_K);
+                slot.out_time_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 6, sizeof(long int)*max_batch*QUERK_TOP_K);
+                slot.out_observables_buffer = device_buffer(CL_MEM_WRITE_ONLY, b + 6, sizeof(long int)*max_batch*QUERK_TOP_K);
+                slot.detector_nodes_buffer = device_buffer(CL_MEM_READ_ONLY, b + 7, sizeof(int)*max_batch);
+            }
+
+            // Write our data set into device buffers. This is the only full upload:
+            // afterwards the graph stays resident and only patches move.
+            err = cu.commands.enqueueWriteBuffer(cu.neighbor_offsets_buffer, CL_FALSE, 0, sizeof(int)*(graph.num_nodes + 1), graph.neighbor_offsets);
+            if (err == CL_SUCCESS) err = cu.commands.enqueueWriteBuffer(cu.edges_buffer, CL_FALSE, 0, sizeof(edge_record)*graph.num_edges, graph.edges);
+            std::vector<cl::Event> written;
+            if (err == CL_SUCCESS) err = write_dynamic_arrays(cu, cu.commands, written);
+            cu.commands.finish();
+
+            if (err != CL_SUCCESS) {
+                printf("Error: Failed to write to device memory!\n");
+                return false;
+            }
+
+            // Set the arguments to our compute kernel; 0 (num_queries) and
+            // 2 (num_patches) change with every batch, and the batch buffers
+            // 1, 11, 12 and 16 with every batch of the async pipeline
+            OCL_CHECK(err, err = cu.krnl.setArg(1, cu.detector_nodes_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(3, cu.patches_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(4, graph.num_nodes));
+            OCL_CHECK(err, err = cu.krnl.setArg(5, graph.num_regions));
+            OCL_CHECK(err, err = cu.krnl.setArg(6, cu.neighbor_offsets_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(7, cu.radius_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(8, cu.region_that_arrived_top_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(9, cu.wrapped_radius_cached_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(10, cu.edges_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(11, cu.out_neighbor_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(12, cu.out_time_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(13, cu.node_states_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(14, (uint32_t) (graph.node_states != NULL)));
+            OCL_CHECK(err, err = cu.krnl.setArg(15, (uint32_t) GRAPH_HBM));
+            OCL_CHECK(err, err = cu.krnl.setArg(16, cu.out_observables_buffer));
+            OCL_CHECK(err, err = cu.krnl.setArg(17, (uint32_t) 0));
+        }
+
+        if (cache_graph && graph_fits_on_chip(graph)) {
+            // One init call per CU copies the graph on chip; every batch after
+            // that only fetches the dynamic arrays from HBM
+            for (uint32_t c = 0; c < cus.size(); c++) {
+                compute_unit & cu = *cus[c];
+                OCL_CHECK(err, err = cu.krnl.setArg(0, (uint32_t) 0));
+                OCL_CHECK(err, err = cu.krnl.setArg(2, (uint32_t) 0));
+                OCL_CHECK(err, err = cu.krnl.setArg(15, (uint32_t) GRAPH_LOAD));
+                OCL_CHECK(err, err = cu.commands.enqueueTask(cu.krnl));
+                OCL_CHECK(err, err = cu.commands.finish());
+                OCL_CHECK(err, err = cu.krnl.setArg(15, (uint32_t) GRAPH_CACHED));
+            }
+            printf("Graph of %u nodes and %u edges cached on chip\n", graph.num_nodes, graph.num_edges);
+        } else if (cache_graph) {
+            printf("Graph of %u nodes and %u edges exceeds the on-chip cache, reading it from HBM\n", graph.num_nodes, graph.num_edges);
+        }
+        return true;
+    }
+
+    // Every CU gets its own copy of the patches. A CU that still holds the
+    // previous round's patches ran no batch since, and one that would
+    // overflow the patch buffer falls back to a full copy.
+    bool update_state(const state_patches & patches) {
+        local_radius = std::max(local_radius, patches.local_radius_bound());
+        if (!kernel_time_bits_fit(max_weight, local_radius)) {
+            return false;
+        }
+        uint32_t num_patches = patches.size();
+        if (num_patches == 0) {
+            return true;
+        }
+        for (uint32_t c = 0; c < cus.size(); c++) {
+            compute_unit & cu = *cus[c];
+            if (num_patches > MAX_PATCHES || cu.pending_patches > 0) {
+                cu.stale = true;
+                cu.pending_patches = 0;
+            }
+            if (cu.stale) {
+                continue;
+            }
+            // blocking: the tracker's words change once this returns
+            cl_int err = cu.commands.enqueueWriteBuffer(cu.patches_buffer, CL_TRUE, 0, sizeof(long int)*2*num_patches, patches.words.data());
+            if (err != CL_SUCCESS) {
+                printf("Error: Failed to write to device memory!\n");
+                return false;
+            }
+            cu.pending_patches = num_patches;
+        }
+        return true;
+    }
+
+    // A CU brings its dynamic arrays up to date first: the patches of this
+    // round if it has not applied them yet, or a full copy if it missed a round.
+    bool submit(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes) {
+        compute_unit & cu = *cus[worker];
+        cl_int err = CL_SUCCESS;
+        uint32_t num_patches = cu.pending_patches;
+        cu.pending_patches = 0;
+        if (cu.stale) {
+            std::vector<cl::Event> written;
+            err = write_dynamic_arrays(cu, cu.commands, written);
+            num_patches = 0;
+            cu.stale = false;
+        }
+
+        if (err == CL_SUCCESS) err = cu.commands.enqueueWriteBuffer(cu.detector_nodes_buffer, CL_FALSE, 0, sizeof(int)*num_queries, detector_nodes);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(1, cu.detector_nodes_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(11, cu.out_neighbor_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(12, cu.out_time_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(16, cu.out_observables_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(0, num_queries);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(2, num_patches);
+        if (err == CL_SUCCESS) err = cu.commands.enqueueTask(cu.krnl);
+
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to execute kernel on CU(%u)! %d\n", worker + 1, err);
+            return false;
+        }
+        return true;
+    }
+
+    bool collect(uint32_t worker, uint32_t num_queries, uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables) {
+        compute_unit & cu = *cus[worker];
+        uint32_t num_results = num_queries*QUERK_TOP_K;
+        cl_int err = cu.commands.enqueueReadBuffer(cu.out_neighbor_buffer, CL_FALSE, 0, sizeof(int)*num_results, out_neighbor);
+        if (err == CL_SUCCESS) err = cu.commands.enqueueReadBuffer(cu.out_time_buffer, CL_FALSE, 0, sizeof(long int)*num_results, out_time);
+        if (err == CL_SUCCESS) err = cu.commands.enqueueReadBuffer(cu.out_observables_buffer, CL_FALSE, 0, sizeof(long int)*num_results, out_observables);
+        cu.commands.finish();
+
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to read output array from CU(%u)! %d\n", worker + 1, err);
+            return false;
+        }
+        return true;
+    }
+
+    // A synchronous batch with the kernel's reduction on, so only the one
+    // winning result crosses PCIe
+    bool query_min(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes, batch_minimum & out) {
+        compute_unit & cu = *cus[worker];
+        cl_int err = cu.krnl.setArg(17, (uint32_t) 1);
+        bool submitted = err == CL_SUCCESS && submit(worker, num_queries, detector_nodes);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(17, (uint32_t) 0);
+        if (!submitted) {
+            return false;
+        }
+
+        uint32_t winner[2];
+        if (err == CL_SUCCESS) err = cu.commands.enqueueReadBuffer(cu.out_neighbor_buffer, CL_FALSE, 0, sizeof(int)*2, winner);
+        if (err == CL_SUCCESS) err = cu.commands.enqueueReadBuffer(cu.out_time_buffer, CL_FALSE, 0, sizeof(long int), &out.time);
+        if (err == CL_SUCCESS) err = cu.commands.enqueueReadBuffer(cu.out_observables_buffer, CL_FALSE, 0, sizeof(long int), &out.observables);
+        cu.commands.finish();
+
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to read output array from CU(%u)! %d\n", worker + 1, err);
+            return false;
+        }
+        out.neighbor = winner[0];
+        out.query = winner[1];
+        return true;
+    }
+
+    // Each batch is a write into a free buffer set, a run that waits for that
+    // write and for the previous run, and three reads that wait for the run;
+    // a marker on the reads fires the callback.
+    bool submit_async(uint32_t worker, uint32_t num_queries, const uint32_t * detector_nodes,
+        uint32_t * out_neighbor, uint64_t * out_time, uint64_t * out_observables, batch_callback done) {
+        compute_unit & cu = *cus[worker];
+        uint32_t s = cu.next_slot;
+        pipeline_slot & slot = cu.slots[s];
+        {
+            std::unique_lock<std::mutex> guard(cu.lock);
+            cu.slot_free.wait(guard, [&slot] { return !slot.busy; });
+            slot.busy = true;
+        }
+        cu.next_slot = (s + 1) % PIPELINE_DEPTH;
+
+        cl_int err = CL_SUCCESS;
+        uint32_t num_patches = cu.pending_patches;
+        cu.pending_patches = 0;
+        std::vector<cl::Event> before_run;
+        if (cu.stale) {
+            err = write_dynamic_arrays(cu, cu.pipeline, before_run);
+            num_patches = 0;
+            cu.stale = false;
+        }
+        if (cu.last_run() != NULL) {
+            before_run.push_back(cu.last_run);
+        }
+
+        cl::Event written, run, marker;
+        std::vector<cl::Event> reads(3);
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueWriteBuffer(slot.detector_nodes_buffer, CL_FALSE, 0, sizeof(int)*num_queries, detector_nodes, NULL, &written);
+        before_run.push_back(written);
+        // arguments are captured when the task is enqueued
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(0, num_queries);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(1, slot.detector_nodes_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(2, num_patches);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(11, slot.out_neighbor_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(12, slot.out_time_buffer);
+        if (err == CL_SUCCESS) err = cu.krnl.setArg(16, slot.out_observables_buffer);
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueTask(cu.krnl, &before_run, &run);
+        std::vector<cl::Event> after_run(1, run);
+        uint32_t num_results = num_queries*QUERK_TOP_K;
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueReadBuffer(slot.out_neighbor_buffer, CL_FALSE, 0, sizeof(int)*num_results, out_neighbor, &after_run, &reads[0]);
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueReadBuffer(slot.out_time_buffer, CL_FALSE, 0, sizeof(long int)*num_results, out_time, &after_run, &reads[1]);
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueReadBuffer(slot.out_observables_buffer, CL_FALSE, 0, sizeof(long int)*num_results, out_observables, &after_run, &reads[2]);
+        if (err == CL_SUCCESS) err = cu.pipeline.enqueueMarkerWithWaitList(&reads, &marker);
+
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to execute kernel on CU(%u)! %d\n", worker + 1, err);
+            std::lock_guard<std::mutex> guard(cu.lock);
+            slot.busy = false;
+            return false;
+        }
+        cu.last_run = run;
+
+        pipeline_batch * batch = new pipeline_batch();
+        batch->cu = &cu;
+        batch->worker = worker;
+        batch->slot = s;
+        batch->done = done;
+        err = marker.setCallback(CL_COMPLETE, batch_complete, batch);
+        if (err == CL_SUCCESS) err = cu.pipeline.flush();
+        if (err != CL_SUCCESS) {
+            printf("Error: Failed to set batch callback on CU(%u)! %d\n", worker + 1, err);
+            return false;
+        }
+        return true;
+    }
+
+    bool drain(uint32_t worker) {
+        compute_unit & cu = *cus[worker];
+        std::unique_lock<std::mutex> guard(cu.lock);
+        cu.slot_free.wait(guard, [&cu] {
+            for (uint32_t s = 0; s < PIPELINE_DEPTH; s++) {
+                if (cu.slots[s].busy) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        bool failed = cu.failed;
+        cu.failed = false;
+        return !failed;
+    }
+};
+
+}
+
+backend * make_opencl_backend(const std::string & xclbin, uint32_t num_cus, bool cache_graph) {
+    opencl_backend * b = new opencl_backend();
+    b->cache_graph = cache_graph;
+    if (!b->program_device(xclbin) || !b->create_compute_units(num_cus)) {
+        delete b;
+        return NULL;
+    }
+    return b;
+}
@@ -0,0 +1,493 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "next_event.h"
+#include "engine.h"
+#include "state_patches.h"
+#include "backend.h"
+#include "reorder.h"
+
+// Latency benchmark for the next-event query over every backend.
+//
+// querk_bench [--backends golden,engine,engine-wide,kernel,kernel-hbm,stream,<xclbin>] [--nodes 1000,100000]
+//             [--degree 2,4,8] [--occupied 0.25,0.5,1] [--batch 64,1024]
+//             [--layout split,packed] [--order input,shuffled,rcm]
+//             [--mode sync,async] [--link <latency us>:<GB/s>]
+//             [--samples 200] [--json out.json]
+//
+// Each point of the sweep builds a ring lattice of the given size and degree
+// (nodes 0 and num_nodes-1 also get a boundary edge), occupies the given
+// fraction of nodes with growing, shrinking or frozen regions, and times
+// submit + collect of single batches of random query nodes on one worker.
+// The engine runs on the narrowest datapath the weights and radii allow (the
+// generated graphs fit 16 bits), engine-wide always in 64 bits.
+// kernel-hbm is the kernel with its on-chip graph cache turned off, stream the
+// free-running querk_stream (packed layout and graphs that fit on chip only).
+// The split layout queries the edge and dynamic arrays, the packed layout one
+// edge_record per edge and one node_state record per node. The kernel always
+// reads edge records. The input order numbers the ring consecutively, shuffled
+// relabels the nodes at random as an arbitrary detector numbering would, and rcm
+// is reverse_cuthill_mckee run on the shuffled graph; queries always name the
+// same nodes in input order and go through the permutation.
+// The sync mode times submit + collect of one batch at a time; the async mode
+// streams all samples through submit_async, timing each batch from submit to
+// its callback and the throughput over the whole stream, so uploads, runs and
+// readbacks of neighbouring batches overlap. --link gives the CPU backends a
+// modelled PCIe link (cpu_link_model) with that latency per transfer and
+// bandwidth, which is what the async pipeline hides. Every batch is also
+// checked against the golden functions.
+
+#define NOW std::chrono::high_resolution_clock::now()
+#define WARMUP_SAMPLES 3
+#define NODES_PER_REGION 10
+
+struct bench_point {
+    std::string backend;
+    std::string layout;
+    std::string order;
+    std::string mode;
+    uint32_t num_nodes;
+    uint32_t degree;
+    double occupied;
+    uint32_t batch_size;
+    uint32_t samples;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+    double mean_us;
+    double queries_per_s;
+    uint64_t mismatches;
+};
+
+// xorshift64*, so a sweep is the same graph on every machine
+struct bench_rng {
+    uint64_t state;
+    explicit bench_rng(uint64_t seed) : state(seed * 2685821657736338717ull + 1) {}
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+    uint32_t below(uint32_t n) { return (uint32_t) ((next() >> 32) * n >> 32); }
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+struct bench_graph {
+    std::vector<uint32_t> neighbor_offsets;
+    std::vector<uint32_t> neighbors;
+    std::vector<uint32_t> neighbor_weights;
+    std::vector<uint64_t> neighbor_observables;
+    std::vector<uint64_t> radius;
+    std::vector<uint32_t> region_that_arrived_top;
+    std::vector<uint32_t> wrapped_radius_cached;
+
+    bench_graph(uint32_t num_nodes, uint32_t degree, double occupied, bench_rng & rng) {
+        uint32_t num_regions = std::max(1u, num_nodes / NODES_PER_REGION);
+        uint32_t half = std::max(1u, degree / 2);
+        neighbor_offsets.resize(num_nodes + 1);
+        for (uint32_t i = 0; i < num_nodes; i++) {
+            neighbor_offsets[i] = neighbors.size();
+            if (i == 0 || i == num_nodes - 1) {
+                neighbors.push_back((uint32_t) -1);
+            }
+            for (uint32_t k = 1; k <= half && 2*k <= num_nodes; k++) {
+                neighbors.push_back((i + num_nodes - k) % num_nodes);
+                if (2*k != num_nodes) {
+                    neighbors.push_back((i + k) % num_nodes);
+                }
+            }
+        }
+        neighbor_offsets[num_nodes] = neighbors.size();
+        neighbor_weights.resize(neighbors.size());
+        for (size_t e = 0; e < neighbors.size(); e++) {
+            neighbor_weights[e] = 8 + 4*rng.below(16);
+        }
+        // a different mask per edge, so returning the wrong edge shows up
+        // as a mismatch even when its time happens to tie
+        neighbor_observables.resize(neighbors.size());
+        for (size_t e = 0; e < neighbors.size(); e++) {
+            neighbor_observables[e] = (uint64_t) 1 << (e % 64);
+        }
+
+        radius.resize(num_regions);
+        for (uint32_t r = 0; r < num_regions; r++) {
+            radius[r] = ((uint64_t) rng.below(1024) << 2) | rng.below(3);
+        }
+        region_that_arrived_top.resize(num_nodes);
+        wrapped_radius_cached.resize(num_nodes);
+        for (uint32_t i = 0; i < num_nodes; i++) {
+            region_that_arrived_top[i] = rng.unit() < occupied ? rng.below(num_regions) : (uint32_t) -1;
+            wrapped_radius_cached[i] = rng.below(64);
+        }
+    }
+
+    void relabel(const node_permutation & perm) {
+        permute_csr(perm, neighbor_offsets, neighbors, neighbor_weights, neighbor_observables);
+        permute_nodes(perm, region_that_arrived_top);
+        permute_nodes(perm, wrapped_radius_cached);
+    }
+};
+
+// input -> internal ids for one --order entry
+static void bench_order(const std::string & name, const bench_graph & g, uint32_t num_nodes, node_permutation & perm) {
+    identity_permutation(num_nodes, perm);
+    if (name == "input") {
+        return;
+    }
+    bench_rng rng(num_nodes);
+    for (uint32_t i = num_nodes - 1; i > 0; i--) {
+        std::swap(perm.to_original[i], perm.to_original[rng.below(i + 1)]);
+    }
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        perm.to_internal[perm.to_original[i]] = i;
+    }
+    if (name == "shuffled") {
+        return;
+    }
+    bench_graph shuffled = g;
+    shuffled.relabel(perm);
+    node_permutation rcm;
+    reverse_cuthill_mckee(num_nodes, shuffled.neighbor_offsets.data(), shuffled.neighbors.data(), rcm);
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        perm.to_internal[n] = rcm.to_internal[perm.to_internal[n]];
+        perm.to_original[perm.to_internal[n]] = n;
+    }
+}
+
+static double percentile(const std::vector<double> & sorted, double p) {
+    // nearest rank
+    size_t rank = (size_t) (p * sorted.size() + 0.999999);
+    rank = std::min(std::max(rank, (size_t) 1), sorted.size());
+    return sorted[rank - 1];
+}
+
+static std::vector<std::string> split(const char * list) {
+    std::vector<std::string> items;
+    std::string s(list);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        if (end > start) {
+            items.push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+static backend * make_bench_backend(const std::string & name, const cpu_link_model & link) {
+    if (name == "golden") {
+        return make_cpu_backend(CPU_GOLDEN, 1, true, link);
+    }
+    if (name == "engine") {
+        return make_cpu_backend(CPU_ENGINE, 1, true, link);
+    }
+    if (name == "engine-wide") {
+        return make_cpu_backend(CPU_ENGINE, 1, true, link, false);
+    }
+    if (name == "kernel") {
+        return make_cpu_backend(CPU_KERNEL, 1, true, link);
+    }
+    if (name == "kernel-hbm") {
+        return make_cpu_backend(CPU_KERNEL, 1, false, link);
+    }
+    if (name == "stream") {
+        return make_cpu_backend(CPU_STREAM, 1, true, link);
+    }
+#ifdef QUERK_CPU_ONLY
+    printf("Error: built without OpenCL, cannot run %s\n", name.c_str());
+    return NULL;
+#else
+    return make_opencl_backend(name, 1);
+#endif
+}
+
+static void write_json(FILE * out, const std::vector<bench_point> & points, const cpu_link_model & link) {
+    fprintf(out, "{\n  \"benchmark\": \"querk_next_event\",\n  \"cpu_isa\": \"%s\",\n  \"link_latency_us\": %g,\n  \"link_gb_per_s\": %g,\n  \"results\": [\n",
+        engine_isa_name(engine_detect()), link.latency_us, link.bytes_per_us / 1000);
+    for (size_t i = 0; i < points.size(); i++) {
+        const bench_point & p = points[i];
+        fprintf(out, "    {\"backend\": \"%s\", \"layout\": \"%s\", \"order\": \"%s\", \"mode\": \"%s\", \"num_nodes\": %u, \"degree\": %u, \"occupied\": %g, \"batch_size\": %u, \"samples\": %u, "
+            "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"mean_us\": %.3f, \"queries_per_s\": %.1f, \"mismatches\": %lu}%s\n",
+            p.backend.c_str(), p.layout.c_str(), p.order.c_str(), p.mode.c_str(), p.num_nodes, p.degree, p.occupied, p.batch_size, p.samples,
+            p.p50_us, p.p90_us, p.p99_us, p.max_us, p.mean_us, p.queries_per_s, (unsigned long) p.mismatches,
+            i + 1 < points.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char * argv[]) {
+    std::vector<std::string> backend_names = split("golden,engine,kernel");
+    std::vector<std::string> nodes_list = split("1000,100000");
+    std::vector<std::string> degree_list = split("2,4,8");
+    std::vector<std::string> occupied_list = split("0.25,0.5,1");
+    std::vector<std::string> batch_list = split("64,1024");
+    std::vector<std::string> layout_list = split("split,packed");
+    std::vector<std::string> order_list = split("input");
+    std::vector<std::string> mode_list = split("sync");
+    cpu_link_model link;
+    uint32_t samples = 200;
+    const char * json_path = NULL;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--backends")) backend_names = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--nodes")) nodes_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--degree")) degree_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--occupied")) occupied_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--batch")) batch_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--layout")) layout_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--order")) order_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--mode")) mode_list = split(argv[i + 1]);
+        else if (!strcmp(argv[i], "--link")) {
+            double gb_per_s = 0;
+            if (sscanf(argv[i + 1], "%lf:%lf", &link.latency_us, &gb_per_s) != 2 || link.latency_us < 0 || gb_per_s <= 0) {
+                printf("Error: --link needs <latency us>:<GB/s>, got %s\n", argv[i + 1]);
+                return 1;
+            }
+            link.bytes_per_us = gb_per_s * 1000;
+        }
+        else if (!strcmp(argv[i], "--samples")) samples = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--json")) json_path = argv[i + 1];
+        else {
+            printf("Error: unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (argc % 2 == 0) {
+        printf("Error: option %s needs a value\n", argv[argc - 1]);
+        return 1;
+    }
+    if (samples < 1) {
+        printf("Error: need at least 1 sample\n");
+        return 1;
+    }
+
+    for (size_t l = 0; l < layout_list.size(); l++) {
+        if (layout_list[l] != "split" && layout_list[l] != "packed") {
+            printf("Error: unknown layout %s, use split or packed\n", layout_list[l].c_str());
+            return 1;
+        }
+    }
+
+    for (size_t r = 0; r < order_list.size(); r++) {
+        if (order_list[r] != "input" && order_list[r] != "shuffled" && order_list[r] != "rcm") {
+            printf("Error: unknown order %s, use input, shuffled or rcm\n", order_list[r].c_str());
+            return 1;
+        }
+    }
+
+    for (size_t m = 0; m < mode_list.size(); m++) {
+        if (mode_list[m] != "sync" && mode_list[m] != "async") {
+            printf("Error: unknown mode %s, use sync or async\n", mode_list[m].c_str());
+            return 1;
+        }
+    }
+
+    uint32_t max_batch = 1;
+    for (size_t b = 0; b < batch_list.size(); b++) {
+        max_batch = std::max(max_batch, (uint32_t) atoi(batch_list[b].c_str()));
+    }
+
+    std::vector<backend *> backends;
+    for (size_t b = 0; b < backend_names.size(); b++) {
+        backend * device = make_bench_backend(backend_names[b], link);
+        if (device == NULL) {
+            return 1;
+        }
+        backends.push_back(device);
+    }
+
+    std::vector<bench_point> points;
+    printf("%-24s %6s %8s %5s %9s %6s %8s %6s %10s %10s %10s %10s %14s\n",
+        "backend", "layout", "order", "mode", "nodes", "degree", "occupied", "batch", "p50 us", "p90 us", "p99 us", "max us", "queries/s");
+
+    for (size_t n = 0; n < nodes_list.size(); n++)
+    for (size_t d = 0; d < degree_list.size(); d++)
+    for (size_t o = 0; o < occupied_list.size(); o++) {
+        uint32_t num_nodes = atoi(nodes_list[n].c_str());
+        uint32_t degree = atoi(degree_list[d].c_str());
+        double occupied = atof(occupied_list[o].c_str());
+        if (num_nodes < 2 || degree < 1) {
+            printf("Error: need at least 2 nodes and degree 1\n");
+            return 1;
+        }
+
+        bench_rng rng(num_nodes * 31 + degree);
+        bench_graph g(num_nodes, degree, occupied, rng);
+
+        for (size_t r = 0; r < order_list.size(); r++) {
+            node_permutation perm;
+            bench_order(order_list[r], g, num_nodes, perm);
+            bench_graph h = g;
+            h.relabel(perm);
+
+            backend_graph graph;
+            graph.num_nodes = num_nodes;
+            graph.num_regions = h.radius.size();
+            graph.num_edges = h.neighbors.size();
+            graph.neighbor_offsets = h.neighbor_offsets.data();
+            graph.neighbors = h.neighbors.data();
+            graph.neighbor_weights = h.neighbor_weights.data();
+            graph.neighbor_observables = h.neighbor_observables.data();
+            std::vector<edge_record> edges(graph.num_edges);
+            pack_edge_records(graph.num_edges, h.neighbors.data(), h.neighbor_weights.data(), h.neighbor_observables.data(), edges.data());
+            graph.edges = edges.data();
+            graph.radius = h.radius.data();
+            graph.region_that_arrived_top = h.region_that_arrived_top.data();
+            graph.wrapped_radius_cached = h.wrapped_radius_cached.data();
+
+            // state_patches needs writable mirrors; nothing is ever patched here
+            state_patches no_patches(h.radius.data(), h.region_that_arrived_top.data(), h.wrapped_radius_cached.data(), num_nodes, graph.num_regions);
+            std::vector<node_state> node_states(num_nodes);
+            no_patches.attach_node_states(node_states.data());
+
+            for (size_t b = 0; b < batch_list.size(); b++) {
+                uint32_t batch_size = atoi(batch_list[b].c_str());
+                if (batch_size < 1) {
+                    printf("Error: need a batch of at least 1 query\n");
+                    return 1;
+                }
+                uint32_t total = batch_size * (samples + WARMUP_SAMPLES);
+                // the same queries for every order
+                bench_rng query_rng(num_nodes * 31 + degree + batch_size);
+                std::vector<uint32_t> detector_nodes(total);
+                std::vector<uint32_t> internal_nodes(total);
+                for (uint32_t q = 0; q < total; q++) {
+                    detector_nodes[q] = query_rng.below(num_nodes);
+                    internal_nodes[q] = perm.to_internal[detector_nodes[q]];
+                }
+                std::vector<uint32_t> golden_neighbor(total);
+                std::vector<uint64_t> golden_time(total);
+                std::vector<uint64_t> golden_observables(total);
+                find_next_event_at_nodes_returning_neighbor_index_and_time(total, detector_nodes.data(), g.neighbor_offsets.data(), g.neighbors.data(), g.neighbor_weights.data(), g.region_that_arrived_top.data(), g.wrapped_radius_cached.data(), g.radius.data(), golden_neighbor.data(), golden_time.data());
+                find_next_event_observables(total, detector_nodes.data(), g.neighbor_offsets.data(), g.neighbor_observables.data(), golden_neighbor.data(), golden_observables.data());
+                // async batches each keep their own outputs until checked,
+                // QUERK_TOP_K candidates per query
+                std::vector<uint32_t> out_neighbor(total*QUERK_TOP_K);
+                std::vector<uint64_t> out_time(total*QUERK_TOP_K);
+                std::vector<uint64_t> out_observables(total*QUERK_TOP_K);
+
+                for (size_t l = 0; l < layout_list.size(); l++)
+                for (size_t m = 0; m < mode_list.size(); m++)
+                for (size_t k = 0; k < backends.size(); k++) {
+                    backend * device = backends[k];
+                    graph.node_states = layout_list[l] == "packed" ? node_states.data() : NULL;
+                    if (!device->upload_graph(graph, max_batch) || !device->update_state(no_patches)) {
+                        return 1;
+                    }
+
+                    bench_point p;
+                    p.backend = device->name();
+                    p.layout = layout_list[l];
+                    p.order = order_list[r];
+                    p.mode = mode_list[m];
+                    p.num_nodes = num_nodes;
+                    p.degree = degree;
+                    p.occupied = occupied;
+                    p.batch_size = batch_size;
+                    p.samples = samples;
+                    p.mismatches = 0;
+
+                    std::vector<double> latency;
+                    latency.reserve(samples);
+                    double total_s = 0;
+                    if (p.mode == "sync") {
+                        for (uint32_t s = 0; s < samples + WARMUP_SAMPLES; s++) {
+                            uint32_t first = s * batch_size;
+                            std::chrono::high_resolution_clock::time_point start = NOW;
+                            if (!device->submit(0, batch_size, internal_nodes.data() + first) ||
+                                !device->collect(0, batch_size, out_neighbor.data() + first*QUERK_TOP_K, out_time.data() + first*QUERK_TOP_K, out_observables.data() + first*QUERK_TOP_K)) {
+                                return 1;
+                            }
+                            std::chrono::high_resolution_clock::time_point end = NOW;
+                            if (s >= WARMUP_SAMPLES) {
+                                double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(end - start).count();
+                                latency.push_back(seconds * 1e6);
+                                total_s += seconds;
+                            }
+                        }
+                    } else {
+                        // the warmup batches fill the pipeline; the clock for
+                        // throughput starts with the first timed submit
+                        std::vector<std::chrono::high_resolution_clock::time_point> submitted(samples + WARMUP_SAMPLES);
+                        std::vector<std::chrono::high_resolution_clock::time_point> completed(samples + WARMUP_SAMPLES);
+                        for (uint32_t s = 0; s < samples + WARMUP_SAMPLES; s++) {
+                            uint32_t first = s * batch_size;
+                            submitted[s] = NOW;
+                            std::chrono::high_resolution_clock::time_point * done_at = &completed[s];
+                            if (!device->submit_async(0, batch_size, internal_nodes.data() + first,
+                                    out_neighbor.data() + first*QUERK_TOP_K, out_time.data() + first*QUERK_TOP_K, out_observables.data() + first*QUERK_TOP_K,
+                                    [done_at] { *done_at = NOW; })) {
+                                return 1;
+                            }
+                        }
+                        if (!device->drain(0)) {
+                            return 1;
+                        }
+                        for (uint32_t s = WARMUP_SAMPLES; s < samples + WARMUP_SAMPLES; s++) {
+                            latency.push_back(std::chrono::duration_cast<std::chrono::duration<double> >(completed[s] - submitted[s]).count() * 1e6);
+                        }
+                        total_s = std::chrono::duration_cast<std::chrono::duration<double> >(completed.back() - submitted[WARMUP_SAMPLES]).count();
+                    }
+                    for (uint32_t q = 0; q < total; q++) {
+                        uint32_t c = q*QUERK_TOP_K;
+                        p.mismatches += out_neighbor[c] != golden_neighbor[q] || out_time[c] != golden_time[q] ||
+                                        out_observables[c] != golden_observables[q];
+                    }
+
+                    std::sort(latency.begin(), latency.end());
+                    p.p50_us = percentile(latency, 0.50);
+                    p.p90_us = percentile(latency, 0.90);
+                    p.p99_us = percentile(latency, 0.99);
+                    p.max_us = latency.back();
+                    double sum_us = 0;
+                    for (size_t i = 0; i < latency.size(); i++) {
+                        sum_us += latency[i];
+                    }
+                    p.mean_us = sum_us / samples;
+                    p.queries_per_s = (double) batch_size * samples / total_s;
+                    points.push_back(p);
+
+                    printf("%-24s %6s %8s %5s %9u %6u %8g %6u %10.2f %10.2f %10.2f %10.2f %14.0f%s\n",
+                        p.backend.c_str(), p.layout.c_str(), p.order.c_str(), p.mode.c_str(), num_nodes, degree, occupied, batch_size,
+                        p.p50_us, p.p90_us, p.p99_us, p.max_us, p.queries_per_s, p.mismatches ? "  MISMATCH" : "");
+                }
+            }
+        }
+    }
+
+    if (json_path != NULL) {
+        FILE * out = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+        if (out == NULL) {
+            printf("Error: cannot write %s\n", json_path);
+            return 1;
+        }
+        write_json(out, points, link);
+        if (out != stdout) {
+            fclose(out);
+        }
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < points.size(); i++) {
+        ok = ok && points[i].mismatches == 0;
+    }
+    for (size_t k = 0; k < backends.size(); k++) {
+        delete backends[k];
+    }
+    if (!ok) {
+        printf("Test failed\n");
+        return 1;
+    }
+    return 0;
+}
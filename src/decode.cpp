@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "flooder.h"
+#include "dispatcher.h"
+
+#define NUM_SHOTS 10000
+#define NUM_DETECTORS 100
+#define ERROR_PROBABILITY 0.05
+#define EDGE_WEIGHT 2
+// Shots are sampled and decoded in slices of this many; each slice draws from
+// its own generator, so the shots do not depend on the number of threads
+#define SHOTS_PER_SLICE 256
+
+#define NOW std::chrono::high_resolution_clock::now();
+
+// Everything one decoding thread writes: its own flooder (and with it its own
+// radius, region_that_arrived_top and wrapped_radius_cached), scratch for the
+// shot being decoded and its share of the totals. The graph arrays are shared
+// read-only by all of them.
+struct decode_worker {
+    flooder decoder;
+    std::vector<uint8_t> errors;
+    std::vector<uint32_t> detection_events;
+    std::vector<uint8_t> seen;
+    std::vector<match> matches;
+    uint64_t total_events;
+    uint64_t total_queries;
+    uint64_t logical_errors;
+    bool valid;
+
+    decode_worker(uint32_t num_nodes, uint32_t * neighbor_offsets, uint32_t * neighbors, uint32_t * neighbor_weights,
+            uint64_t * neighbor_observables)
+        : decoder(num_nodes, neighbor_offsets, neighbors, neighbor_weights, neighbor_observables),
+          errors(num_nodes + 1),
+          seen(num_nodes),
+          total_events(0),
+          total_queries(0),
+          logical_errors(0),
+          valid(true) {}
+};
+
+// Decodes random repetition-code shots on the CPU flooder, one shot per thread
+// at a time over a work-stealing pool, and reports the end-to-end decode
+// latency per shot, the throughput of the pool and the logical error rate.
+//   querk_decode [num_shots] [error_probability] [seed] [num_detectors] [num_threads]
+int main(int argc, char *argv[]){
+
+    uint32_t num_shots = NUM_SHOTS;
+    double error_probability = ERROR_PROBABILITY;
+    uint32_t seed = 0;
+    uint32_t num_nodes = NUM_DETECTORS;
+    if (argc >= 2) {
+        num_shots = atoi(argv[1]);
+    }
+    if (argc >= 3) {
+        error_probability = atof(argv[2]);
+    }
+    if (argc >= 4) {
+        seed = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        num_nodes = atoi(argv[4]);
+    }
+    uint32_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc >= 6) {
+        num_threads = std::max(1, atoi(argv[5]));
+    }
+    if (num_shots == 0) {
+        printf("Nothing to decode\n");
+        return 0;
+    }
+    if (num_nodes < 2) {
+        printf("Error: the repetition code needs at least 2 detectors\n");
+        printf("Test failed\n");
+        return 1;
+    }
+
+    // Repetition code: detector i compares data qubits i and i+1, so the two end
+    // detectors keep their boundary edge first.
+    std::vector<uint32_t> neighbor_offsets(num_nodes + 1);
+    std::vector<uint32_t> neighbors;
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        neighbor_offsets[i] = neighbors.size();
+        if (i == 0) {
+            neighbors.push_back(BOUNDARY_NODE);
+            neighbors.push_back(i + 1);
+        } else if (i == num_nodes - 1) {
+            neighbors.push_back(BOUNDARY_NODE);
+            neighbors.push_back(i - 1);
+        } else {
+            neighbors.push_back(i - 1);
+            neighbors.push_back(i + 1);
+        }
+    }
+    neighbor_offsets[num_nodes] = neighbors.size();
+    std::vector<uint32_t> neighbor_weights(neighbors.size(), EDGE_WEIGHT*WEIGHT_SCALE);
+    // The logical observable is data qubit 0, which only detector 0's boundary edge crosses
+    std::vector<uint64_t> neighbor_observables(neighbors.size(), 0);
+    neighbor_observables[0] = 1;
+
+    std::vector<std::unique_ptr<decode_worker> > workers;
+    for (uint32_t w = 0; w < num_threads; w++) {
+        workers.emplace_back(new decode_worker(num_nodes, neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), neighbor_observables.data()));
+    }
+    std::vector<double> latency(num_shots);
+
+    auto decode_slice = [&](uint32_t worker, const query_batch & slice) {
+        decode_worker & state = *workers[worker];
+        std::seed_seq slice_seed = {seed, slice.first};
+        std::mt19937 rng(slice_seed);
+        std::bernoulli_distribution flip(error_probability);
+        for (uint32_t shot = slice.first; shot < slice.first + slice.num_queries; shot++) {
+            for (uint32_t q = 0; q <= num_nodes; q++) {
+                state.errors[q] = flip(rng);
+            }
+            state.detection_events.clear();
+            for (uint32_t i = 0; i < num_nodes; i++) {
+                if (state.errors[i] ^ state.errors[i + 1]) {
+                    state.detection_events.push_back(i);
+                }
+            }
+
+            std::chrono::high_resolution_clock::time_point start = NOW;
+            bool matched = state.decoder.decode(state.detection_events.data(), state.detection_events.size(), state.matches);
+            std::chrono::high_resolution_clock::time_point end = NOW;
+            latency[shot] = std::chrono::duration_cast<std::chrono::duration<double>>(end-start).count();
+            state.total_events += state.detection_events.size();
+            state.total_queries += state.decoder.num_queries;
+            // the correction leaves either no error or a logical one on every data qubit
+            state.logical_errors += (state.decoder.observables & 1) != state.errors[0];
+
+            // Every detection event must be matched exactly once
+            std::fill(state.seen.begin(), state.seen.end(), 0);
+            for (const match & m : state.matches) {
+                state.seen[m.a]++;
+                if (m.b != BOUNDARY_NODE) {
+                    state.seen[m.b]++;
+                }
+            }
+            bool valid = matched;
+            for (uint32_t node : state.detection_events) {
+                valid = valid && state.seen[node] == 1;
+            }
+            if (!valid || state.matches.size() > state.detection_events.size()) {
+                printf("Shot %u: invalid matching for %lu detection events\n", shot, (unsigned long) state.detection_events.size());
+                state.valid = false;
+            }
+        }
+    };
+
+    std::chrono::high_resolution_clock::time_point start = NOW;
+    dispatcher pool(num_threads, decode_slice);
+    pool.submit_range(num_shots, SHOTS_PER_SLICE);
+    pool.wait();
+    std::chrono::high_resolution_clock::time_point end = NOW;
+    double wall = std::chrono::duration_cast<std::chrono::duration<double>>(end-start).count();
+
+    uint64_t total_events = 0;
+    uint64_t total_queries = 0;
+    uint64_t logical_errors = 0;
+    bool test_result = true;
+    for (uint32_t w = 0; w < num_threads; w++) {
+        total_events += workers[w]->total_events;
+        total_queries += workers[w]->total_queries;
+        logical_errors += workers[w]->logical_errors;
+        test_result = test_result && workers[w]->valid;
+    }
+
+    std::vector<double> sorted = latency;
+    std::sort(sorted.begin(), sorted.end());
+    double mean = 0;
+    for (double t : latency) {
+        mean += t;
+    }
+    mean /= num_shots;
+
+    printf("Decoded %u shots of a %u-detector repetition code at p=%lf\n", num_shots, num_nodes, error_probability);
+    printf("Detection events per shot: %lf, next-event queries per shot: %lf\n", (double) total_events / num_shots, (double) total_queries / num_shots);
+    printf("Decode latency per shot: mean %lf us, p50 %lf us, p99 %lf us, max %lf us\n",
+        mean*1e6, sorted[num_shots/2]*1e6, sorted[(size_t) (num_shots*0.99)]*1e6, sorted[num_shots-1]*1e6);
+    printf("Throughput: %lf shots/s on %u threads (%lf shots/s per thread), sampling included\n",
+        num_shots / wall, num_threads, num_shots / wall / num_threads);
+    for (uint32_t w = 0; w < num_threads; w++) {
+        printf("  thread %u: %lu shots in %lu slices (%lu stolen)\n", w, (unsigned long) pool.stats[w].num_queries,
+            (unsigned long) pool.stats[w].num_batches, (unsigned long) pool.stats[w].num_stolen);
+    }
+    size_t arena_bytes = 0;
+    size_t arena_peak = 0;
+    for (uint32_t w = 0; w < num_threads; w++) {
+        arena_bytes = std::max(arena_bytes, workers[w]->decoder.scratch.capacity());
+        arena_peak = std::max(arena_peak, workers[w]->decoder.scratch.peak);
+    }
+    printf("Scratch arena: %lu bytes per thread, at most %lu used by a shot\n", (unsigned long) arena_bytes, (unsigned long) arena_peak);
+    printf("Logical errors: %lu of %u shots (%lf)\n", (unsigned long) logical_errors, num_shots, (double) logical_errors / num_shots);
+
+    if (test_result)
+        std::cout<<"All matchings valid"<<std::endl;
+    else
+        std::cout<<"Test failed"<<std::endl;
+
+    return test_result ? 0 : 1;
+}
@@ -0,0 +1,447 @@
+#include "dem.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+
+#define NO_NODE ((uint32_t) -1)
+#define EMPTY_KEY ((uint64_t) -1)
+#define READ_BUFFER_SIZE (1 << 20)
+// typical length of an error(p) D.. D.. line, for sizing the edge table
+#define BYTES_PER_ERROR 40
+
+namespace {
+
+// Slot of the open-addressing index; key and position share a cache line
+struct dem_slot {
+    uint64_t key;
+    uint32_t index;
+};
+
+// Edges seen so far, one column per field in first-seen order, with an
+// open-addressing index from (a << 32 | b) to the edge's position so parallel
+// edges are merged as they arrive. b is NO_NODE for a boundary edge.
+struct dem_edges {
+    std::vector<uint32_t> a;
+    std::vector<uint32_t> b;
+    std::vector<double> probability;
+    std::vector<uint64_t> observables;
+    std::vector<dem_slot> slots;
+    int shift;
+    uint64_t num_merged;
+
+    dem_edges() : slots(1024, dem_slot{EMPTY_KEY, 0}), shift(64 - 10), num_merged(0) {}
+
+    // Sizes the columns and the index for about expected_edges edges up front,
+    // so a large model is not rehashed and copied on its way in
+    void reserve(size_t expected_edges) {
+        a.reserve(expected_edges);
+        b.reserve(expected_edges);
+        probability.reserve(expected_edges);
+        observables.reserve(expected_edges);
+        while (slots.size() < 2 * expected_edges) {
+            slots.resize(2 * slots.size());
+            shift--;
+        }
+        slots.assign(slots.size(), dem_slot{EMPTY_KEY, 0});
+    }
+
+    // Fibonacci hashing: the top bits of the product mix all bits of the key
+    size_t find(uint64_t key) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = (key * 0x9E3779B97F4A7C15ull) >> shift;
+        while (slots[slot].key != EMPTY_KEY && slots[slot].key != key) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void grow() {
+        std::vector<dem_slot> old_slots;
+        old_slots.swap(slots);
+        slots.assign(old_slots.size() * 2, dem_slot{EMPTY_KEY, 0});
+        shift--;
+        for (size_t i = 0; i < old_slots.size(); i++) {
+            if (old_slots[i].key != EMPTY_KEY) {
+                slots[find(old_slots[i].key)] = old_slots[i];
+            }
+        }
+    }
+
+    void add(uint32_t u, uint32_t v, double p, uint64_t obs) {
+        if (v < u) {
+            std::swap(u, v);
+        }
+        uint64_t key = ((uint64_t) u << 32) | v;
+        size_t slot = find(key);
+        if (slots[slot].key == key) {
+            uint32_t e = slots[slot].index;
+            double q = probability[e];
+            if (observables[e] == obs) {
+                probability[e] = p * (1 - q) + q * (1 - p);
+            } else if (p > q) {
+                probability[e] = p;
+                observables[e] = obs;
+            }
+            num_merged++;
+            return;
+        }
+        slots[slot].key = key;
+        slots[slot].index = a.size();
+        a.push_back(u);
+        b.push_back(v);
+        probability.push_back(p);
+        observables.push_back(obs);
+        if (2 * a.size() >= slots.size()) {
+            grow();
+        }
+    }
+};
+
+const char * skip_spaces(const char * s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') {
+        s++;
+    }
+    return s;
+}
+
+// Matches an instruction name followed by a delimiter; returns the rest or NULL
+const char * word(const char * s, const char * name) {
+    size_t n = strlen(name);
+    if (strncmp(s, name, n) != 0) {
+        return NULL;
+    }
+    char c = s[n];
+    if (c == 0 || c == ' ' || c == '\t' || c == '(' || c == '[' || c == '\r' || c == '\n') {
+        return s + n;
+    }
+    return NULL;
+}
+
+// Skips an optional [tag] and (arguments) after an instruction name
+const char * skip_tag_and_arguments(const char * s) {
+    if (*s == '[') {
+        const char * end = strchr(s, ']');
+        s = end ? end + 1 : s + strlen(s);
+    }
+    if (*s == '(') {
+        const char * end = strchr(s, ')');
+        s = end ? end + 1 : s + strlen(s);
+    }
+    return s;
+}
+
+bool is_end(const char * s) {
+    return *s == 0 || *s == '#';
+}
+
+struct dem_parser {
+    const char * path;
+    dem_edges edges;
+    uint64_t detector_offset;
+    uint32_t num_nodes;
+    uint32_t num_observables;
+    uint64_t num_errors;
+    uint64_t num_hyperedges;
+
+    bool fail(const char * what, const char * line) {
+        printf("Error: %s in %s: %s\n", what, path, line);
+        return false;
+    }
+
+    bool detector_target(const char * & s, uint32_t & node, const char * line) {
+        char * end;
+        uint64_t k = strtoull(s + 1, &end, 10) + detector_offset;
+        if (end == s + 1 || k >= NO_NODE) {
+            return fail("bad detector target", line);
+        }
+        node = k;
+        if (node >= num_nodes) {
+            num_nodes = node + 1;
+        }
+        s = end;
+        return true;
+    }
+
+    bool observable_target(const char * & s, uint64_t & mask, const char * line) {
+        char * end;
+        uint64_t k = strtoull(s + 1, &end, 10);
+        if (end == s + 1 || k >= 64) {
+            return fail("bad or unsupported (>= 64) logical observable", line);
+        }
+        mask |= (uint64_t) 1 << k;
+        if (k >= num_observables) {
+            num_observables = k + 1;
+        }
+        s = end;
+        return true;
+    }
+
+    void component(uint32_t * detectors, uint32_t num_detectors, double p, uint64_t obs) {
+        if (num_detectors == 1) {
+            edges.add(detectors[0], NO_NODE, p, obs);
+        } else if (num_detectors == 2 && detectors[0] != detectors[1]) {
+            edges.add(detectors[0], detectors[1], p, obs);
+        } else if (num_detectors > 2) {
+            num_hyperedges++;
+        }
+    }
+
+    bool error(const char * s, const char * line) {
+        if (*s == '[') {
+            const char * end = strchr(s, ']');
+            s = end ? end + 1 : s;
+        }
+        if (*s != '(') {
+            return fail("error without probability", line);
+        }
+        char * end;
+        double p = strtod(s + 1, &end);
+        if (end == s + 1 || *end != ')' || !(p >= 0 && p <= 1)) {
+            return fail("bad error probability", line);
+        }
+        s = end + 1;
+        num_errors++;
+
+        uint32_t detectors[3];
+        uint32_t num_detectors = 0;
+        uint64_t obs = 0;
+        while (true) {
+            s = skip_spaces(s);
+            if (is_end(s) || *s == '^') {
+                if (p > 0) {
+                    component(detectors, num_detectors, p, obs);
+                }
+                if (*s != '^') {
+                    return true;
+                }
+                num_detectors = 0;
+                obs = 0;
+                s++;
+            } else if (*s == 'D') {
+                uint32_t node;
+                if (!detector_target(s, node, line)) {
+                    return false;
+                }
+                if (num_detectors < 3) {
+                    detectors[num_detectors++] = node;
+                }
+            } else if (*s == 'L') {
+                if (!observable_target(s, obs, line)) {
+                    return false;
+                }
+            } else {
+                return fail("bad error target", line);
+            }
+        }
+    }
+
+    bool instruction(const char * line) {
+        const char * s = skip_spaces(line);
+        const char * rest;
+        if (is_end(s)) {
+            return true;
+        }
+        if ((rest = word(s, "error"))) {
+            return error(rest, line);
+        }
+        if ((rest = word(s, "detector"))) {
+            s = skip_spaces(skip_tag_and_arguments(rest));
+            while (*s == 'D') {
+                uint32_t node;
+                if (!detector_target(s, node, line)) {
+                    return false;
+                }
+                s = skip_spaces(s);
+            }
+            return is_end(s) || fail("bad detector target", line);
+        }
+        if ((rest = word(s, "logical_observable"))) {
+            s = skip_spaces(skip_tag_and_arguments(rest));
+            uint64_t mask = 0;
+            while (*s == 'L') {
+                if (!observable_target(s, mask, line)) {
+                    return false;
+                }
+                s = skip_spaces(s);
+            }
+            return is_end(s) || fail("bad logical observable", line);
+        }
+        if ((rest = word(s, "shift_detectors"))) {
+            s = skip_spaces(skip_tag_and_arguments(rest));
+            char * end;
+            uint64_t shift = strtoull(s, &end, 10);
+            if (end == s) {
+                return fail("bad shift_detectors", line);
+            }
+            detector_offset += shift;
+            return true;
+        }
+        return fail("unknown instruction", line);
+    }
+
+    // repeat count, or 0 if the line does not open a repeat block
+    uint64_t repeat_count(const char * s, const char * line, bool & ok) {
+        const char * rest = word(s, "repeat");
+        if (!rest) {
+            return 0;
+        }
+        rest = skip_spaces(skip_tag_and_arguments(rest));
+        char * end;
+        uint64_t count = strtoull(rest, &end, 10);
+        if (end == rest || *skip_spaces(end) != '{') {
+            ok = fail("bad repeat block", line);
+        }
+        return count;
+    }
+
+    // Replays the buffered lines [begin, end) of a repeat block
+    bool block(const std::vector<std::string> & body, size_t begin, size_t end, uint64_t repetitions) {
+        for (uint64_t r = 0; r < repetitions; r++) {
+            for (size_t j = begin; j < end; j++) {
+                const char * s = skip_spaces(body[j].c_str());
+                bool ok = true;
+                uint64_t count = repeat_count(s, body[j].c_str(), ok);
+                if (!ok) {
+                    return false;
+                }
+                if (!word(s, "repeat")) {
+                    if (!instruction(s)) {
+                        return false;
+                    }
+                    continue;
+                }
+                size_t close = j + 1;
+                for (int depth = 1; close < end; close++) {
+                    const char * t = skip_spaces(body[close].c_str());
+                    if (word(t, "repeat")) {
+                        depth++;
+                    } else if (*t == '}' && --depth == 0) {
+                        break;
+                    }
+                }
+                if (!block(body, j + 1, close, count)) {
+                    return false;
+                }
+                j = close;
+            }
+        }
+        return true;
+    }
+};
+
+}
+
+bool load_dem(const char * path, uint32_t weight_scale, dem_graph & graph) {
+    FILE * file = fopen(path, "r");
+    if (!file) {
+        printf("Error: cannot open detector error model %s\n", path);
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, READ_BUFFER_SIZE);
+    struct stat file_stat;
+
+    dem_parser parser;
+    if (fstat(fileno(file), &file_stat) == 0) {
+        parser.edges.reserve(file_stat.st_size / BYTES_PER_ERROR);
+    }
+    parser.path = path;
+    parser.detector_offset = 0;
+    parser.num_nodes = 0;
+    parser.num_observables = 0;
+    parser.num_errors = 0;
+    parser.num_hyperedges = 0;
+
+    char * line = NULL;
+    size_t capacity = 0;
+    bool ok = true;
+    while (ok && getline(&line, &capacity, file) != -1) {
+        const char * s = skip_spaces(line);
+        uint64_t count = parser.repeat_count(s, line, ok);
+        if (!ok) {
+            break;
+        }
+        if (!word(s, "repeat")) {
+            ok = (*s == '}') ? parser.fail("unmatched }", line) : parser.instruction(s);
+            continue;
+        }
+        // Only repeat bodies are buffered, as text, to be replayed
+        std::vector<std::string> body;
+        int depth = 1;
+        while (depth > 0 && getline(&line, &capacity, file) != -1) {
+            const char * t = skip_spaces(line);
+            if (word(t, "repeat")) {
+                depth++;
+            } else if (*t == '}') {
+                depth--;
+            }
+            if (depth > 0) {
+                body.push_back(line);
+            }
+        }
+        ok = (depth == 0) ? parser.block(body, 0, body.size(), count) : parser.fail("unterminated repeat block", "");
+    }
+    free(line);
+    fclose(file);
+    if (!ok) {
+        return false;
+    }
+
+    // Scatter the merged edges into CSR, each node's boundary edge first
+    const dem_edges & edges = parser.edges;
+    uint32_t num_nodes = parser.num_nodes;
+    size_t num_edges = edges.a.size();
+    graph.num_nodes = num_nodes;
+    graph.num_observables = parser.num_observables;
+    graph.num_errors = parser.num_errors;
+    graph.num_merged = edges.num_merged;
+    graph.num_hyperedges = parser.num_hyperedges;
+    identity_permutation(num_nodes, graph.order);
+    graph.neighbor_offsets.assign(num_nodes + 1, 0);
+    for (size_t e = 0; e < num_edges; e++) {
+        graph.neighbor_offsets[edges.a[e] + 1]++;
+        if (edges.b[e] != NO_NODE) {
+            graph.neighbor_offsets[edges.b[e] + 1]++;
+        }
+    }
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        graph.neighbor_offsets[i + 1] += graph.neighbor_offsets[i];
+    }
+    uint32_t num_slots = graph.neighbor_offsets[num_nodes];
+    graph.neighbors.resize(num_slots);
+    graph.neighbor_weights.resize(num_slots);
+    graph.neighbor_observables.resize(num_slots);
+
+    std::vector<uint32_t> cursor(graph.neighbor_offsets.begin(), graph.neighbor_offsets.end() - 1);
+    for (int boundary_pass = 1; boundary_pass >= 0; boundary_pass--) {
+        for (size_t e = 0; e < num_edges; e++) {
+            bool boundary = edges.b[e] == NO_NODE;
+            if (boundary != (bool) boundary_pass) {
+                continue;
+            }
+            double p = edges.probability[e];
+            double w = (p < 0.5) ? log((1 - p) / p) * DEM_WEIGHT_RESOLUTION : 0;
+            uint32_t weight = 2 * (uint32_t) llround(w / 2) * weight_scale;
+
+            uint32_t slot = cursor[edges.a[e]]++;
+            graph.neighbors[slot] = edges.b[e];
+            graph.neighbor_weights[slot] = weight;
+            graph.neighbor_observables[slot] = edges.observables[e];
+            if (!boundary) {
+                slot = cursor[edges.b[e]]++;
+                graph.neighbors[slot] = edges.a[e];
+                graph.neighbor_weights[slot] = weight;
+                graph.neighbor_observables[slot] = edges.observables[e];
+            }
+        }
+    }
+    return true;
+}
+
+void reorder_dem_nodes(dem_graph & graph) {
+    reverse_cuthill_mckee(graph.num_nodes, graph.neighbor_offsets.data(), graph.neighbors.data(), graph.order);
+    permute_csr(graph.order, graph.neighbor_offsets, graph.neighbors, graph.neighbor_weights, graph.neighbor_observables);
+}
@@ -0,0 +1,46 @@
+#ifndef DEM_H
+#define DEM_H
+
+#include <stdint.h>
+#include <vector>
+#include "reorder.h"
+
+// Weights are log((1 - p) / p) * DEM_WEIGHT_RESOLUTION, rounded to an even integer
+#define DEM_WEIGHT_RESOLUTION 64
+
+// Matching graph read from a stim detector error model, in the CSR layout of
+// next_event.h. Each node is a detector; a boundary edge is stored first with
+// neighbor -1. neighbor_observables holds one bit per logical observable.
+struct dem_graph {
+    uint32_t num_nodes;
+    uint32_t num_observables;
+    std::vector<uint32_t> neighbor_offsets;
+    std::vector<uint32_t> neighbors;
+    std::vector<uint32_t> neighbor_weights;
+    std::vector<uint64_t> neighbor_observables;
+    // detector id <-> node id; the identity unless reorder_dem_nodes() ran
+    node_permutation order;
+
+    // what the loader saw
+    uint64_t num_errors;
+    uint64_t num_merged;
+    uint64_t num_hyperedges;
+};
+
+// Streams the DEM at path once, line by line. error(p) instructions are split
+// at ^ into graph-like components; a component with one detector becomes a
+// boundary edge, one with more than two detectors cannot be matched and is
+// counted in num_hyperedges and dropped. Parallel edges are merged as
+// independent mechanisms (p = p1 (1 - p2) + p2 (1 - p1)) when they flip the
+// same observables, otherwise the more likely one is kept. repeat blocks and
+// shift_detectors are honoured. Every weight is multiplied by weight_scale
+// (WEIGHT_SCALE for the flooder, 1 for the kernel alone).
+// Returns false and prints the reason if the file cannot be read or parsed.
+bool load_dem(const char * path, uint32_t weight_scale, dem_graph & graph);
+
+// Relabels the nodes in reverse Cuthill-McKee order (reorder.h) so the
+// neighbors of a node sit close to it in every per-node array. Detector ids
+// from the DEM become node ids through graph.order.to_internal.
+void reorder_dem_nodes(dem_graph & graph);
+
+#endif
@@ -0,0 +1,115 @@
+#include "dispatcher.h"
+#include <algorithm>
+
+dispatcher::dispatcher(uint32_t num_workers, run_function run)
+    : num_workers(num_workers), run(run), stats(num_workers),
+      num_queued(0), num_unfinished(0), next_queue(0), stopping(false) {
+    for (uint32_t w = 0; w < num_workers; w++) {
+        queues.emplace_back(new worker_queue());
+    }
+    clear_stats();
+    for (uint32_t w = 0; w < num_workers; w++) {
+        threads.emplace_back(&dispatcher::worker_loop, this, w);
+    }
+}
+
+dispatcher::~dispatcher() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (size_t w = 0; w < threads.size(); w++) {
+        threads[w].join();
+    }
+}
+
+void dispatcher::submit(const query_batch & batch) {
+    {
+        std::lock_guard<std::mutex> guard(queues[next_queue]->lock);
+        queues[next_queue]->batches.push_back(batch);
+    }
+    next_queue = (next_queue + 1) % num_workers;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        num_queued++;
+        num_unfinished++;
+    }
+    // wake everyone: the owner of that queue may be busy, an idle worker steals it
+    work_ready.notify_all();
+}
+
+void dispatcher::submit_range(uint32_t num_queries, uint32_t batch_size) {
+    for (uint32_t first = 0; first < num_queries; first += batch_size) {
+        query_batch batch;
+        batch.first = first;
+        batch.num_queries = std::min(batch_size, num_queries - first);
+        submit(batch);
+    }
+}
+
+void dispatcher::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    work_done.wait(guard, [this] { return num_unfinished == 0; });
+}
+
+void dispatcher::clear_stats() {
+    for (uint32_t w = 0; w < num_workers; w++) {
+        stats[w].num_batches = 0;
+        stats[w].num_queries = 0;
+        stats[w].num_stolen = 0;
+    }
+}
+
+// Own queue from the front, then the other queues from the back.
+bool dispatcher::take(uint32_t worker, query_batch & batch, bool & stolen) {
+    for (uint32_t i = 0; i < num_workers; i++) {
+        worker_queue & queue = *queues[(worker + i) % num_workers];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.batches.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            batch = queue.batches.front();
+            queue.batches.pop_front();
+        } else {
+            batch = queue.batches.back();
+            queue.batches.pop_back();
+        }
+        stolen = i != 0;
+        return true;
+    }
+    return false;
+}
+
+void dispatcher::worker_loop(uint32_t worker) {
+    for (;;) {
+        {
+            // Claim one batch. A batch is pushed before it is counted, so a
+            // claimed batch is always sitting in one of the queues.
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [this] { return stopping || num_queued > 0; });
+            if (num_queued == 0) {
+                return;
+            }
+            num_queued--;
+        }
+
+        query_batch batch;
+        bool stolen;
+        while (!take(worker, batch, stolen)) {
+            std::this_thread::yield();
+        }
+
+        run(worker, batch);
+
+        stats[worker].num_batches++;
+        stats[worker].num_queries += batch.num_queries;
+        stats[worker].num_stolen += stolen;
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (--num_unfinished == 0) {
+            work_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A slice [first, first + num_queries) of the caller's query arrays.
+struct query_batch {
+    uint32_t first;
+    uint32_t num_queries;
+};
+
+struct worker_stats {
+    uint64_t num_batches;
+    uint64_t num_queries;
+    // batches this worker took from another worker's queue
+    uint64_t num_stolen;
+};
+
+// Spreads query batches over num_workers threads, one per compute unit (or per
+// CPU core). Batches are dealt round-robin into per-worker queues; a worker runs
+// its own queue from the front and, once it is empty, steals from the back of
+// the others, so a slow compute unit does not hold up the rest. run(worker, batch)
+// is always called on the thread owned by worker, so per-worker state (a kernel
+// object, its command queue and buffers) needs no locking.
+struct dispatcher {
+    typedef std::function<void(uint32_t worker, const query_batch & batch)> run_function;
+
+    struct worker_queue {
+        std::mutex lock;
+        std::deque<query_batch> batches;
+    };
+
+    uint32_t num_workers;
+    run_function run;
+    std::vector<std::unique_ptr<worker_queue> > queues;
+    std::vector<worker_stats> stats;
+    std::vector<std::thread> threads;
+
+    // batches submitted but not yet claimed by a worker / not yet finished
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    uint32_t num_queued;
+    uint32_t num_unfinished;
+    uint32_t next_queue;
+    bool stopping;
+
+    dispatcher(uint32_t num_workers, run_function run);
+    ~dispatcher();
+
+    void submit(const query_batch & batch);
+    // Cuts [0, num_queries) into batches of at most batch_size and submits them.
+    void submit_range(uint32_t num_queries, uint32_t batch_size);
+    // Blocks until every submitted batch has run.
+    void wait();
+    void clear_stats();
+
+    void worker_loop(uint32_t worker);
+    bool take(uint32_t worker, query_batch & batch, bool & stolen);
+};
+
+#endif
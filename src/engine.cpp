@@ -0,0 +1,578 @@
+#include "engine.h"
+#include <immintrin.h>
+
+engine_isa engine_detect() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+        return ENGINE_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return ENGINE_AVX2;
+    }
+    return ENGINE_SCALAR;
+}
+
+const char * engine_isa_name(engine_isa isa) {
+    switch (isa) {
+        case ENGINE_AVX512: return "avx512";
+        case ENGINE_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// Where the vector paths find an edge's neighbor and weight and a node's region
+// and local radius: the separate arrays, or the edge and node records.
+struct split_layout {
+    const int * nbr;
+    const int * wts;
+    const int * rtat;
+    const int * wrc;
+    uint64_t * radius;
+};
+
+struct packed_layout {
+    const edge_record * edges;
+    const node_state * records;
+};
+
+// radius[region] + (wrapped << 2) in every lane that has a region, 0 elsewhere.
+// The shift stays 32 bits wide and is zero-extended, as in the golden functions.
+__attribute__((target("avx2")))
+static inline __m256i local_radius_avx2(uint64_t * radius, __m128i region, __m128i wrapped, __m128i has_region) {
+    __m256i mask = _mm256_cvtepi32_epi64(has_region);
+    __m256i rad = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), (const long long *) radius, region, mask, 8);
+    __m256i wrap = _mm256_cvtepu32_epi64(_mm_slli_epi32(wrapped, 2));
+    return _mm256_and_si256(_mm256_add_epi64(rad, wrap), mask);
+}
+
+// neighbor and weight of the CSR slot in the active lanes; 0 elsewhere
+__attribute__((target("avx2")))
+static inline void load_edge_avx2(const split_layout & layout, __m128i slot, __m128i active, __m128i & neighbor, __m128i & weight) {
+    neighbor = _mm_mask_i32gather_epi32(_mm_setzero_si128(), layout.nbr, slot, active, 4);
+    weight = _mm_mask_i32gather_epi32(_mm_setzero_si128(), layout.wts, slot, active, 4);
+}
+
+// Both gathers hit the same 16-byte record. The record index is scaled in
+// 32 bits: up to 2^29 edge slots.
+__attribute__((target("avx2")))
+static inline void load_edge_avx2(const packed_layout & layout, __m128i slot, __m128i active, __m128i & neighbor, __m128i & weight) {
+    __m128i index = _mm_slli_epi32(slot, 2);
+    neighbor = _mm_mask_i32gather_epi32(_mm_setzero_si128(), (const int *) layout.edges, index, active, 4);
+    weight = _mm_mask_i32gather_epi32(_mm_setzero_si128(), (const int *) layout.edges + 1, index, active, 4);
+}
+
+// region and local radius of node in the active lanes; -1 and 0 elsewhere
+__attribute__((target("avx2")))
+static inline void load_state_avx2(const split_layout & state, __m128i node, __m128i active, __m128i & region, __m256i & rad) {
+    const __m128i none32 = _mm_set1_epi32(-1);
+    region = _mm_mask_i32gather_epi32(none32, state.rtat, node, active, 4);
+    __m128i wrapped = _mm_mask_i32gather_epi32(_mm_setzero_si128(), state.wrc, node, active, 4);
+    __m128i has_region = _mm_xor_si128(_mm_cmpeq_epi32(region, none32), none32);
+    rad = local_radius_avx2(state.radius, region, wrapped, has_region);
+}
+
+// Both fields sit in the same 16-byte record, so the two gathers do not
+// depend on each other. The record index is scaled in 32 bits: up to 2^29 nodes.
+__attribute__((target("avx2")))
+static inline void load_state_avx2(const packed_layout & state, __m128i node, __m128i active, __m128i & region, __m256i & rad) {
+    region = _mm_mask_i32gather_epi32(_mm_set1_epi32(-1), (const int *) state.records + 2, _mm_slli_epi32(node, 2), active, 4);
+    rad = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), (const long long *) state.records, _mm_slli_epi32(node, 1), _mm256_cvtepi32_epi64(active), 8);
+}
+
+// unsigned 64-bit a < b
+__attribute__((target("avx2")))
+static inline __m256i less_than_avx2(__m256i a, __m256i b) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign));
+}
+
+// 4 x 64-bit lane mask -> 4 x 32-bit lane mask
+__attribute__((target("avx2")))
+static inline __m128i narrow_mask_avx2(__m256i mask) {
+    return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(mask, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+}
+
+template <class L>
+__attribute__((target("avx2")))
+static uint32_t find_next_events_avx2(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const L & layout,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    const int * offsets = (const int *) neighbor_offsets;
+    const __m128i zero32 = _mm_setzero_si128();
+    const __m128i none32 = _mm_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i two = _mm256_set1_epi64x(2);
+    const __m256i y_mask = _mm256_set1_epi64x(~3ll);
+
+    uint32_t q = 0;
+    for (; q + 4 <= num_queries; q += 4) {
+        __m128i node = _mm_loadu_si128((const __m128i *) (detector_nodes + q));
+        __m128i row = _mm_i32gather_epi32(offsets, node, 4);
+        __m128i nn = _mm_sub_epi32(_mm_i32gather_epi32(offsets + 1, node, 4), row);
+        __m128i region;
+        __m256i rad1;
+        load_state_avx2(layout, node, none32, region, rad1);
+        __m256i growing = _mm256_cmpeq_epi64(_mm256_and_si256(rad1, one), one);
+        __m256i rad1_y = _mm256_and_si256(rad1, y_mask);
+
+        __m256i best_time = _mm256_set1_epi64x(MAX);
+        __m128i best_neighbor = none32;
+
+        // Boundary edge first, only an event for a growing region
+        __m128i has_neighbors = _mm_cmpgt_epi32(nn, zero32);
+        __m128i first, weight;
+        load_edge_avx2(layout, row, has_neighbors, first, weight);
+        __m128i boundary = _mm_and_si128(has_neighbors, _mm_cmpeq_epi32(first, none32));
+        __m256i time = _mm256_sub_epi64(_mm256_cvtepu32_epi64(weight), rad1_y);
+        __m256i update = _mm256_and_si256(_mm256_and_si256(growing, _mm256_cvtepi32_epi64(boundary)), less_than_avx2(time, best_time));
+        best_time = _mm256_blendv_epi8(best_time, time, update);
+        best_neighbor = _mm_blendv_epi8(best_neighbor, zero32, narrow_mask_avx2(update));
+
+        // walk the edges of all lanes together until the largest degree is done
+        for (int i = 0; ; i++) {
+            __m128i index = _mm_set1_epi32(i);
+            __m128i active = _mm_cmpgt_epi32(nn, index);
+            if (_mm_testz_si128(active, active)) {
+                break;
+            }
+            if (i == 0) {
+                active = _mm_andnot_si128(boundary, active);
+            }
+            __m128i slot = _mm_add_epi32(row, index);
+            __m128i neighbor;
+            load_edge_avx2(layout, slot, active, neighbor, weight);
+            __m128i neighbor_region;
+            __m256i rad2;
+            load_state_avx2(layout, neighbor, active, neighbor_region, rad2);
+
+            time = _mm256_sub_epi64(_mm256_sub_epi64(_mm256_cvtepu32_epi64(weight), rad1_y), _mm256_and_si256(rad2, y_mask));
+            __m256i rad2_growing = _mm256_cmpeq_epi64(_mm256_and_si256(rad2, one), one);
+            __m256i rad2_shrinking = _mm256_cmpeq_epi64(_mm256_and_si256(rad2, two), two);
+            __m256i active64 = _mm256_cvtepi32_epi64(active);
+            __m256i same_region = _mm256_cvtepi32_epi64(_mm_cmpeq_epi32(region, neighbor_region));
+
+            // growing node: skip its own region and shrinking neighbors, halve when both grow
+            __m256i time_growing = _mm256_blendv_epi8(time, _mm256_srli_epi64(time, 1), rad2_growing);
+            __m256i valid_growing = _mm256_andnot_si256(_mm256_or_si256(same_region, rad2_shrinking), active64);
+            // any other node: only growing neighbors can reach it
+            __m256i valid_other = _mm256_and_si256(active64, rad2_growing);
+
+            time = _mm256_blendv_epi8(time, time_growing, growing);
+            __m256i valid = _mm256_blendv_epi8(valid_other, valid_growing, growing);
+            update = _mm256_and_si256(valid, less_than_avx2(time, best_time));
+            best_time = _mm256_blendv_epi8(best_time, time, update);
+            best_neighbor = _mm_blendv_epi8(best_neighbor, index, narrow_mask_avx2(update));
+        }
+
+        _mm256_storeu_si256((__m256i *) (out_time + q), best_time);
+        _mm_storeu_si128((__m128i *) (out_neighbor + q), best_neighbor);
+    }
+    return q;
+}
+
+// Narrow datapath (time_bits_for() <= 32): one query in each 32-bit lane, 8 at
+// a time. Only the low 32 bits of a radius word are loaded; the times come out
+// modulo 2^32 and go through widen_time() on the way out.
+
+// neighbor and weight of the CSR slot in the 8 active lanes; 0 elsewhere
+__attribute__((target("avx2")))
+static inline void load_edge_avx2(const split_layout & layout, __m256i slot, __m256i active, __m256i & neighbor, __m256i & weight) {
+    neighbor = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), layout.nbr, slot, active, 4);
+    weight = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), layout.wts, slot, active, 4);
+}
+
+__attribute__((target("avx2")))
+static inline void load_edge_avx2(const packed_layout & layout, __m256i slot, __m256i active, __m256i & neighbor, __m256i & weight) {
+    __m256i index = _mm256_slli_epi32(slot, 2);
+    neighbor = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *) layout.edges, index, active, 4);
+    weight = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *) layout.edges + 1, index, active, 4);
+}
+
+// region and the low half of the local radius; -1 and 0 outside the active lanes
+__attribute__((target("avx2")))
+static inline void load_state_narrow_avx2(const split_layout & state, __m256i node, __m256i active, __m256i & region, __m256i & rad) {
+    const __m256i none32 = _mm256_set1_epi32(-1);
+    region = _mm256_mask_i32gather_epi32(none32, state.rtat, node, active, 4);
+    __m256i wrapped = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), state.wrc, node, active, 4);
+    __m256i has_region = _mm256_xor_si256(_mm256_cmpeq_epi32(region, none32), none32);
+    rad = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *) state.radius, _mm256_slli_epi32(region, 1), has_region, 4);
+    rad = _mm256_and_si256(_mm256_add_epi32(rad, _mm256_slli_epi32(wrapped, 2)), has_region);
+}
+
+__attribute__((target("avx2")))
+static inline void load_state_narrow_avx2(const packed_layout & state, __m256i node, __m256i active, __m256i & region, __m256i & rad) {
+    __m256i index = _mm256_slli_epi32(node, 2);
+    region = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(-1), (const int *) state.records + 2, index, active, 4);
+    rad = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *) state.records, index, active, 4);
+}
+
+// unsigned 32-bit a < b
+__attribute__((target("avx2")))
+static inline __m256i less_than_epu32_avx2(__m256i a, __m256i b) {
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    return _mm256_cmpgt_epi32(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign));
+}
+
+template <class L>
+__attribute__((target("avx2")))
+static uint32_t find_next_events_narrow_avx2(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const L & layout,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    const int * offsets = (const int *) neighbor_offsets;
+    const __m256i zero32 = _mm256_setzero_si256();
+    const __m256i none32 = _mm256_set1_epi32(-1);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i y_mask = _mm256_set1_epi32(~3);
+    uint32_t times[8];
+
+    uint32_t q = 0;
+    for (; q + 8 <= num_queries; q += 8) {
+        __m256i node = _mm256_loadu_si256((const __m256i *) (detector_nodes + q));
+        __m256i row = _mm256_i32gather_epi32(offsets, node, 4);
+        __m256i nn = _mm256_sub_epi32(_mm256_i32gather_epi32(offsets + 1, node, 4), row);
+        __m256i region, rad1;
+        load_state_narrow_avx2(layout, node, none32, region, rad1);
+        __m256i growing = _mm256_cmpeq_epi32(_mm256_and_si256(rad1, one), one);
+        __m256i rad1_y = _mm256_and_si256(rad1, y_mask);
+
+        __m256i best_time = _mm256_set1_epi32((int) time_none(32));
+        __m256i best_neighbor = none32;
+
+        __m256i has_neighbors = _mm256_cmpgt_epi32(nn, zero32);
+        __m256i first, weight;
+        load_edge_avx2(layout, row, has_neighbors, first, weight);
+        __m256i boundary = _mm256_and_si256(has_neighbors, _mm256_cmpeq_epi32(first, none32));
+        __m256i time = _mm256_sub_epi32(weight, rad1_y);
+        __m256i update = _mm256_and_si256(_mm256_and_si256(growing, boundary), less_than_epu32_avx2(time, best_time));
+        best_time = _mm256_blendv_epi8(best_time, time, update);
+        best_neighbor = _mm256_blendv_epi8(best_neighbor, zero32, update);
+
+        for (int i = 0; ; i++) {
+            __m256i index = _mm256_set1_epi32(i);
+            __m256i active = _mm256_cmpgt_epi32(nn, index);
+            if (_mm256_testz_si256(active, active)) {
+                break;
+            }
+            if (i == 0) {
+                active = _mm256_andnot_si256(boundary, active);
+            }
+            __m256i neighbor, neighbor_region, rad2;
+            load_edge_avx2(layout, _mm256_add_epi32(row, index), active, neighbor, weight);
+            load_state_narrow_avx2(layout, neighbor, active, neighbor_region, rad2);
+
+            time = _mm256_sub_epi32(_mm256_sub_epi32(weight, rad1_y), _mm256_and_si256(rad2, y_mask));
+            __m256i rad2_growing = _mm256_cmpeq_epi32(_mm256_and_si256(rad2, one), one);
+            __m256i rad2_shrinking = _mm256_cmpeq_epi32(_mm256_and_si256(rad2, two), two);
+            __m256i same_region = _mm256_cmpeq_epi32(region, neighbor_region);
+
+            __m256i time_growing = _mm256_blendv_epi8(time, _mm256_srli_epi32(time, 1), rad2_growing);
+            __m256i valid_growing = _mm256_andnot_si256(_mm256_or_si256(same_region, rad2_shrinking), active);
+            __m256i valid_other = _mm256_and_si256(active, rad2_growing);
+
+            time = _mm256_blendv_epi8(time, time_growing, growing);
+            __m256i valid = _mm256_blendv_epi8(valid_other, valid_growing, growing);
+            update = _mm256_and_si256(valid, less_than_epu32_avx2(time, best_time));
+            best_time = _mm256_blendv_epi8(best_time, time, update);
+            best_neighbor = _mm256_blendv_epi8(best_neighbor, index, update);
+        }
+
+        _mm256_storeu_si256((__m256i *) times, best_time);
+        for (int k = 0; k < 8; k++) {
+            out_time[q + k] = widen_time(times[k], 32);
+        }
+        _mm256_storeu_si256((__m256i *) (out_neighbor + q), best_neighbor);
+    }
+    return q;
+}
+
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i local_radius_avx512(uint64_t * radius, __m256i region, __m256i wrapped, __mmask8 has_region) {
+    __m512i rad = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), has_region, region, (const long long *) radius, 8);
+    __m512i wrap = _mm512_maskz_cvtepu32_epi64(0xff, _mm256_slli_epi32(wrapped, 2));
+    return _mm512_maskz_add_epi64(has_region, rad, wrap);
+}
+
+__attribute__((target("avx512f,avx512vl")))
+static inline void load_edge_avx512(const split_layout & layout, __m256i slot, __mmask8 active, __m256i & neighbor, __m256i & weight) {
+    neighbor = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), active, slot, layout.nbr, 4);
+    weight = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), active, slot, layout.wts, 4);
+}
+
+__attribute__((target("avx512f,avx512vl")))
+static inline void load_edge_avx512(const packed_layout & layout, __m256i slot, __mmask8 active, __m256i & neighbor, __m256i & weight) {
+    __m256i index = _mm256_slli_epi32(slot, 2);
+    neighbor = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), active, index, (const int *) layout.edges, 4);
+    weight = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), active, index, (const int *) layout.edges + 1, 4);
+}
+
+__attribute__((target("avx512f,avx512vl")))
+static inline void load_state_avx512(const split_layout & state, __m256i node, __mmask8 active, __m256i & region, __m512i & rad) {
+    const __m256i none32 = _mm256_set1_epi32(-1);
+    region = _mm256_mmask_i32gather_epi32(none32, active, node, state.rtat, 4);
+    __m256i wrapped = _mm256_mmask_i32gather_epi32(_mm256_setzero_si256(), active, node, state.wrc, 4);
+    __mmask8 has_region = _mm256_mask_cmpneq_epi32_mask(active, region, none32);
+    rad = local_radius_avx512(state.radius, region, wrapped, has_region);
+}
+
+__attribute__((target("avx512f,avx512vl")))
+static inline void load_state_avx512(const packed_layout & state, __m256i node, __mmask8 active, __m256i & region, __m512i & rad) {
+    region = _mm256_mmask_i32gather_epi32(_mm256_set1_epi32(-1), active, _mm256_slli_epi32(node, 2), (const int *) state.records + 2, 4);
+    rad = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), active, _mm256_slli_epi32(node, 1), (const long long *) state.records, 8);
+}
+
+template <class L>
+__attribute__((target("avx512f,avx512vl")))
+static uint32_t find_next_events_avx512(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const L & layout,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    const int * offsets = (const int *) neighbor_offsets;
+    const __m256i zero32 = _mm256_setzero_si256();
+    const __m256i none32 = _mm256_set1_epi32(-1);
+    const __m512i one = _mm512_set1_epi64(1);
+    const __m512i two = _mm512_set1_epi64(2);
+    const __m512i y_mask = _mm512_set1_epi64(~3ll);
+
+    uint32_t q = 0;
+    for (; q + 8 <= num_queries; q += 8) {
+        __m256i node = _mm256_loadu_si256((const __m256i *) (detector_nodes + q));
+        __m256i row = _mm256_i32gather_epi32(offsets, node, 4);
+        __m256i nn = _mm256_sub_epi32(_mm256_i32gather_epi32(offsets + 1, node, 4), row);
+        __m256i region;
+        __m512i rad1;
+        load_state_avx512(layout, node, 0xff, region, rad1);
+        __mmask8 growing = _mm512_test_epi64_mask(rad1, one);
+        __m512i rad1_y = _mm512_and_si512(rad1, y_mask);
+
+        __m512i best_time = _mm512_set1_epi64(MAX);
+        __m256i best_neighbor = none32;
+
+        // Boundary edge first, only an event for a growing region
+        __mmask8 has_neighbors = _mm256_cmpgt_epi32_mask(nn, zero32);
+        __m256i first, weight;
+        load_edge_avx512(layout, row, has_neighbors, first, weight);
+        __mmask8 boundary = _mm256_mask_cmpeq_epi32_mask(has_neighbors, first, none32);
+        __m512i time = _mm512_sub_epi64(_mm512_maskz_cvtepu32_epi64(0xff, weight), rad1_y);
+        __mmask8 update = _mm512_mask_cmplt_epu64_mask(growing & boundary, time, best_time);
+        best_time = _mm512_mask_mov_epi64(best_time, update, time);
+        best_neighbor = _mm256_mask_mov_epi32(best_neighbor, update, zero32);
+
+        // walk the edges of all lanes together until the largest degree is done
+        for (int i = 0; ; i++) {
+            __m256i index = _mm256_set1_epi32(i);
+            __mmask8 active = _mm256_cmpgt_epi32_mask(nn, index);
+            if (!active) {
+                break;
+            }
+            if (i == 0) {
+                active &= ~boundary;
+            }
+            __m256i slot = _mm256_add_epi32(row, index);
+            __m256i neighbor;
+            load_edge_avx512(layout, slot, active, neighbor, weight);
+            __m256i neighbor_region;
+            __m512i rad2;
+            load_state_avx512(layout, neighbor, active, neighbor_region, rad2);
+
+            time = _mm512_sub_epi64(_mm512_sub_epi64(_mm512_maskz_cvtepu32_epi64(0xff, weight), rad1_y), _mm512_and_si512(rad2, y_mask));
+            __mmask8 rad2_growing = _mm512_test_epi64_mask(rad2, one);
+            __mmask8 rad2_shrinking = _mm512_test_epi64_mask(rad2, two);
+            __mmask8 same_region = _mm256_cmpeq_epi32_mask(region, neighbor_region);
+
+            // growing node: skip its own region and shrinking neighbors, halve when both grow
+            time = _mm512_mask_srli_epi64(time, growing & rad2_growing, time, 1);
+            __mmask8 valid_growing = active & ~same_region & ~rad2_shrinking;
+            // any other node: only growing neighbors can reach it
+            __mmask8 valid_other = active & rad2_growing;
+
+            __mmask8 valid = (growing & valid_growing) | (~growing & valid_other);
+            update = _mm512_mask_cmplt_epu64_mask(valid, time, best_time);
+            best_time = _mm512_mask_mov_epi64(best_time, update, time);
+            best_neighbor = _mm256_mask_mov_epi32(best_neighbor, update, index);
+        }
+
+        _mm512_storeu_si512((void *) (out_time + q), best_time);
+        _mm256_storeu_si256((__m256i *) (out_neighbor + q), best_neighbor);
+    }
+    return q;
+}
+
+// Narrow datapath, 16 queries per 512-bit register
+__attribute__((target("avx512f")))
+static inline void load_edge_avx512(const split_layout & layout, __m512i slot, __mmask16 active, __m512i & neighbor, __m512i & weight) {
+    neighbor = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, slot, layout.nbr, 4);
+    weight = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, slot, layout.wts, 4);
+}
+
+__attribute__((target("avx512f")))
+static inline void load_edge_avx512(const packed_layout & layout, __m512i slot, __mmask16 active, __m512i & neighbor, __m512i & weight) {
+    __m512i index = _mm512_maskz_slli_epi32(0xffff, slot, 2);
+    neighbor = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, index, (const int *) layout.edges, 4);
+    weight = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, index, (const int *) layout.edges + 1, 4);
+}
+
+__attribute__((target("avx512f")))
+static inline void load_state_narrow_avx512(const split_layout & state, __m512i node, __mmask16 active, __m512i & region, __m512i & rad) {
+    const __m512i none32 = _mm512_set1_epi32(-1);
+    region = _mm512_mask_i32gather_epi32(none32, active, node, state.rtat, 4);
+    __m512i wrapped = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, node, state.wrc, 4);
+    __mmask16 has_region = _mm512_mask_cmpneq_epi32_mask(active, region, none32);
+    rad = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), has_region, _mm512_maskz_slli_epi32(0xffff, region, 1), (const int *) state.radius, 4);
+    rad = _mm512_maskz_add_epi32(has_region, rad, _mm512_maskz_slli_epi32(0xffff, wrapped, 2));
+}
+
+__attribute__((target("avx512f")))
+static inline void load_state_narrow_avx512(const packed_layout & state, __m512i node, __mmask16 active, __m512i & region, __m512i & rad) {
+    __m512i index = _mm512_maskz_slli_epi32(0xffff, node, 2);
+    region = _mm512_mask_i32gather_epi32(_mm512_set1_epi32(-1), active, index, (const int *) state.records + 2, 4);
+    rad = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, index, (const int *) state.records, 4);
+}
+
+template <class L>
+__attribute__((target("avx512f")))
+static uint32_t find_next_events_narrow_avx512(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const L & layout,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    const int * offsets = (const int *) neighbor_offsets;
+    const __m512i zero32 = _mm512_setzero_si512();
+    const __m512i none32 = _mm512_set1_epi32(-1);
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i two = _mm512_set1_epi32(2);
+    const __m512i y_mask = _mm512_set1_epi32(~3);
+    uint32_t times[16];
+
+    uint32_t q = 0;
+    for (; q + 16 <= num_queries; q += 16) {
+        __m512i node = _mm512_loadu_si512((const void *) (detector_nodes + q));
+        __m512i row = _mm512_mask_i32gather_epi32(zero32, 0xffff, node, offsets, 4);
+        __m512i nn = _mm512_sub_epi32(_mm512_mask_i32gather_epi32(zero32, 0xffff, node, offsets + 1, 4), row);
+        __m512i region, rad1;
+        load_state_narrow_avx512(layout, node, 0xffff, region, rad1);
+        __mmask16 growing = _mm512_test_epi32_mask(rad1, one);
+        __m512i rad1_y = _mm512_and_si512(rad1, y_mask);
+
+        __m512i best_time = _mm512_set1_epi32((int) time_none(32));
+        __m512i best_neighbor = none32;
+
+        __mmask16 has_neighbors = _mm512_cmpgt_epi32_mask(nn, zero32);
+        __m512i first, weight;
+        load_edge_avx512(layout, row, has_neighbors, first, weight);
+        __mmask16 boundary = _mm512_mask_cmpeq_epi32_mask(has_neighbors, first, none32);
+        __m512i time = _mm512_sub_epi32(weight, rad1_y);
+        __mmask16 update = _mm512_mask_cmplt_epu32_mask(growing & boundary, time, best_time);
+        best_time = _mm512_mask_mov_epi32(best_time, update, time);
+        best_neighbor = _mm512_mask_mov_epi32(best_neighbor, update, zero32);
+
+        for (int i = 0; ; i++) {
+            __m512i index = _mm512_set1_epi32(i);
+            __mmask16 active = _mm512_cmpgt_epi32_mask(nn, index);
+            if (!active) {
+                break;
+            }
+            if (i == 0) {
+                active &= ~boundary;
+            }
+            __m512i neighbor, neighbor_region, rad2;
+            load_edge_avx512(layout, _mm512_add_epi32(row, index), active, neighbor, weight);
+            load_state_narrow_avx512(layout, neighbor, active, neighbor_region, rad2);
+
+            time = _mm512_sub_epi32(_mm512_sub_epi32(weight, rad1_y), _mm512_and_si512(rad2, y_mask));
+            __mmask16 rad2_growing = _mm512_test_epi32_mask(rad2, one);
+            __mmask16 rad2_shrinking = _mm512_test_epi32_mask(rad2, two);
+            __mmask16 same_region = _mm512_cmpeq_epi32_mask(region, neighbor_region);
+
+            time = _mm512_mask_srli_epi32(time, growing & rad2_growing, time, 1);
+            __mmask16 valid_growing = active & ~same_region & ~rad2_shrinking;
+            __mmask16 valid_other = active & rad2_growing;
+
+            __mmask16 valid = (growing & valid_growing) | (~growing & valid_other);
+            update = _mm512_mask_cmplt_epu32_mask(valid, time, best_time);
+            best_time = _mm512_mask_mov_epi32(best_time, update, time);
+            best_neighbor = _mm512_mask_mov_epi32(best_neighbor, update, index);
+        }
+
+        _mm512_storeu_si512((void *) times, best_time);
+        for (int k = 0; k < 16; k++) {
+            out_time[q + k] = widen_time(times[k], 32);
+        }
+        _mm512_storeu_si512((void *) (out_neighbor + q), best_neighbor);
+    }
+    return q;
+}
+
+void engine_find_next_events(
+    engine_isa isa,
+    uint32_t time_bits,
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    split_layout layout = {(const int *) neighbors, (const int *) neighbor_weights,
+        (const int *) region_that_arrived_top, (const int *) wrapped_radius_cached, radius};
+    uint32_t done = 0;
+    if (isa == ENGINE_AVX512 && time_bits <= 32) {
+        done = find_next_events_narrow_avx512(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX512) {
+        done = find_next_events_avx512(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX2 && time_bits <= 32) {
+        done = find_next_events_narrow_avx2(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX2) {
+        done = find_next_events_avx2(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    }
+    // whatever does not fill a vector goes through the golden path
+    find_next_event_at_nodes_returning_neighbor_index_and_time(num_queries - done, detector_nodes + done, neighbor_offsets, neighbors, neighbor_weights,
+        region_that_arrived_top, wrapped_radius_cached, radius, out_neighbor + done, out_time + done);
+}
+
+void engine_find_next_events_packed(
+    engine_isa isa,
+    uint32_t time_bits,
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    packed_layout layout = {edges, node_states};
+    uint32_t done = 0;
+    if (isa == ENGINE_AVX512 && time_bits <= 32) {
+        done = find_next_events_narrow_avx512(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX512) {
+        done = find_next_events_avx512(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX2 && time_bits <= 32) {
+        done = find_next_events_narrow_avx2(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    } else if (isa == ENGINE_AVX2) {
+        done = find_next_events_avx2(num_queries, detector_nodes, neighbor_offsets, layout, out_neighbor, out_time);
+    }
+    find_next_event_at_nodes_packed_returning_neighbor_index_and_time(num_queries - done, detector_nodes + done, neighbor_offsets, edges,
+        node_states, out_neighbor + done, out_time + done);
+}
@@ -0,0 +1,55 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "next_event.h"
+
+enum engine_isa {
+    ENGINE_SCALAR,
+    ENGINE_AVX2,
+    ENGINE_AVX512
+};
+
+// Widest instruction set the CPU engine can use on this machine.
+engine_isa engine_detect();
+const char * engine_isa_name(engine_isa isa);
+
+// Same contract and results as find_next_event_at_nodes_returning_neighbor_index_and_time.
+// The AVX2 and AVX-512 paths put one query node in each 64-bit lane (4 or 8 at a
+// time), gather region_that_arrived_top / wrapped_radius_cached / radius for all
+// lanes at once and replace the per-neighbor branches with masks, keeping the
+// lowest neighbor index on ties. ENGINE_SCALAR runs the golden functions.
+// time_bits is the datapath width time_bits_for() (next_event.h) allows for the
+// graph and its current state: at 32 or below the vector paths compute in 32-bit
+// lanes, twice as many queries per register, and widen the times on the way
+// out. 16 runs the 32-bit lanes, the gathers being 32 bits wide anyway.
+void engine_find_next_events(
+    engine_isa isa,
+    uint32_t time_bits,
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+// engine_find_next_events over the edge and node records: the neighbor and
+// weight gathers hit the same edge record, and the region and local radius of
+// each neighbor come from one node record instead of two gathers followed by a
+// dependent radius gather.
+void engine_find_next_events_packed(
+    engine_isa isa,
+    uint32_t time_bits,
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+#endif
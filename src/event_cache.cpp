@@ -0,0 +1,45 @@
+#include "event_cache.h"
+#include <algorithm>
+
+event_cache::event_cache(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, uint32_t candidates)
+    : neighbor_offsets(neighbor_offsets),
+      neighbors(neighbors),
+      candidates(candidates),
+      version(num_nodes, 1),
+      cached_version(num_nodes, 0),
+      best_neighbor((size_t) num_nodes*candidates, (uint32_t) -1),
+      best_time((size_t) num_nodes*candidates, 0),
+      best_observables((size_t) num_nodes*candidates, 0),
+      hits(0),
+      misses(0) {}
+
+bool event_cache::lookup(uint32_t node, uint32_t * neighbor, uint64_t * time, uint64_t * observables) {
+    if (cached_version[node] != version[node]) {
+        misses++;
+        return false;
+    }
+    hits++;
+    size_t first = (size_t) node*candidates;
+    std::copy(best_neighbor.begin() + first, best_neighbor.begin() + first + candidates, neighbor);
+    std::copy(best_time.begin() + first, best_time.begin() + first + candidates, time);
+    std::copy(best_observables.begin() + first, best_observables.begin() + first + candidates, observables);
+    return true;
+}
+
+void event_cache::store(uint32_t node, const uint32_t * neighbor, const uint64_t * time, const uint64_t * observables) {
+    size_t first = (size_t) node*candidates;
+    cached_version[node] = version[node];
+    std::copy(neighbor, neighbor + candidates, best_neighbor.begin() + first);
+    std::copy(time, time + candidates, best_time.begin() + first);
+    std::copy(observables, observables + candidates, best_observables.begin() + first);
+}
+
+void event_cache::invalidate(uint32_t node) {
+    version[node]++;
+    for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+        // boundary edges have no node to invalidate
+        if (neighbors[e] != (uint32_t) -1) {
+            version[neighbors[e]]++;
+        }
+    }
+}
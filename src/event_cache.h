@@ -0,0 +1,46 @@
+#ifndef EVENT_CACHE_H
+#define EVENT_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Host memo of the last result answered for every node: its candidates
+// (neighbor, time and observables, best first), as many as the backend
+// returns per query.
+// A next event only depends on the region_that_arrived_top and
+// wrapped_radius_cached entries of the node and its neighbors and on the
+// radius of their regions, so every node carries a version that is bumped
+// whenever one of those entries is written (see state_patches::attach_cache).
+// A result stays valid while the version it was stored under is current, and
+// a lookup is O(1) without touching the device.
+struct event_cache {
+    const uint32_t * neighbor_offsets;
+    const uint32_t * neighbors;
+    uint32_t candidates;
+
+    std::vector<uint64_t> version;
+    // version each result was stored under, 0 when nothing is cached
+    std::vector<uint64_t> cached_version;
+    // candidates entries per node
+    std::vector<uint32_t> best_neighbor;
+    std::vector<uint64_t> best_time;
+    std::vector<uint64_t> best_observables;
+
+    // lookups since the last clear_stats(), for sizing what is worth caching
+    uint64_t hits;
+    uint64_t misses;
+
+    event_cache(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, uint32_t candidates = 1);
+
+    // True and the cached candidates copied out if the node's neighborhood is
+    // unchanged since store(); the outputs are left alone on a miss
+    bool lookup(uint32_t node, uint32_t * neighbor, uint64_t * time, uint64_t * observables);
+    // The result must have been computed against the arrays as they are now
+    void store(uint32_t node, const uint32_t * neighbor, const uint64_t * time, const uint64_t * observables);
+    // An entry of the node changed: its own result and its neighbors' are stale
+    void invalidate(uint32_t node);
+
+    void clear_stats() { hits = 0; misses = 0; }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "event_frontier.h"
+
+event_frontier::event_frontier(uint32_t num_nodes, uint32_t * neighbor_offsets, uint32_t * neighbors, uint32_t * neighbor_weights,
+        uint32_t * region_that_arrived_top, uint32_t * wrapped_radius_cached, uint64_t * radius)
+    : num_nodes(num_nodes),
+      neighbor_offsets(neighbor_offsets),
+      neighbors(neighbors),
+      neighbor_weights(neighbor_weights),
+      region_that_arrived_top(region_that_arrived_top),
+      wrapped_radius_cached(wrapped_radius_cached),
+      radius(radius),
+      isa(engine_detect()),
+      best_neighbor(num_nodes, (uint32_t) -1),
+      best_time(num_nodes, MAX),
+      version(num_nodes, 0),
+      in_batch(num_nodes, 0),
+      num_recomputed(0) {}
+
+void event_frontier::add(uint32_t node) {
+    if (node != (uint32_t) -1 && !in_batch[node]) {
+        in_batch[node] = 1;
+        batch.push_back(node);
+    }
+}
+
+void event_frontier::run_batch(uint32_t time_bits) {
+    uint32_t n = batch.size();
+    batch_neighbor.resize(n);
+    batch_time.resize(n);
+    engine_find_next_events(isa, time_bits, n, batch.data(), neighbor_offsets, neighbors, neighbor_weights,
+        region_that_arrived_top, wrapped_radius_cached, radius, batch_neighbor.data(), batch_time.data());
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t node = batch[j];
+        in_batch[node] = 0;
+        version[node]++;
+        best_neighbor[node] = batch_neighbor[j];
+        best_time[node] = batch_time[j];
+        if (batch_time[j] != (uint64_t) MAX) {
+            queue.push({batch_time[j], node, version[node]});
+        }
+    }
+    num_recomputed = n;
+    batch.clear();
+
+    // Every node has at most one live entry, so rebuild once the stale ones dominate
+    if (queue.size() > 2 * (size_t) num_nodes) {
+        std::vector<frontier_entry> live;
+        live.reserve(num_nodes);
+        for (uint32_t node = 0; node < num_nodes; node++) {
+            if (best_time[node] != (uint64_t) MAX) {
+                live.push_back({best_time[node], node, version[node]});
+            }
+        }
+        queue = std::priority_queue<frontier_entry, std::vector<frontier_entry>, frontier_entry_later>(
+            frontier_entry_later(), std::move(live));
+    }
+}
+
+next_event event_frontier::recompute_all(uint32_t time_bits) {
+    for (uint32_t node = 0; node < num_nodes; node++) {
+        add(node);
+    }
+    run_batch(time_bits);
+    return minimum();
+}
+
+next_event event_frontier::update(const std::vector<std::vector<uint32_t> > & region_nodes,
+        const uint32_t * changed_regions, uint32_t num_changed_regions,
+        const uint32_t * changed_nodes, uint32_t num_changed_nodes, uint32_t time_bits) {
+    std::vector<uint32_t> changed(changed_nodes, changed_nodes + num_changed_nodes);
+    for (uint32_t r = 0; r < num_changed_regions; r++) {
+        const std::vector<uint32_t> & nodes = region_nodes[changed_regions[r]];
+        changed.insert(changed.end(), nodes.begin(), nodes.end());
+    }
+    for (uint32_t node : changed) {
+        add(node);
+        for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+            add(neighbors[e]);
+        }
+    }
+    run_batch(time_bits);
+    return minimum();
+}
+
+next_event event_frontier::minimum() {
+    while (!queue.empty()) {
+        const frontier_entry & top = queue.top();
+        if (top.version == version[top.node]) {
+            return {top.node, best_neighbor[top.node], top.time};
+        }
+        queue.pop();
+    }
+    return {(uint32_t) -1, (uint32_t) -1, (uint64_t) MAX};
+}
@@ -0,0 +1,77 @@
+#ifndef EVENT_FRONTIER_H
+#define EVENT_FRONTIER_H
+
+#include <stdint.h>
+#include <queue>
+#include <vector>
+#include "next_event.h"
+#include "engine.h"
+
+// The earliest event over the whole graph; node is -1 and time MAX when no
+// node has one.
+struct next_event {
+    uint32_t node;
+    uint32_t neighbor;
+    uint64_t time;
+};
+
+struct frontier_entry {
+    uint64_t time;
+    uint32_t node;
+    uint32_t version;
+};
+
+struct frontier_entry_later {
+    bool operator()(const frontier_entry & x, const frontier_entry & y) const {
+        return x.time > y.time || (x.time == y.time && x.node > y.node);
+    }
+};
+
+// Keeps the next event of every node and their minimum current while the
+// dynamic arrays change underneath. A change to radius[r] can only move the
+// events of the nodes region r owns and of their neighbors, so update() takes
+// the changed regions (and nodes whose own entries changed), finds those nodes
+// through the region-to-node index of state_patches and reruns the engine on
+// them alone: the work follows the size of the touched regions instead of the
+// graph. Superseded heap entries are skipped by version, as in the flooder.
+struct event_frontier {
+    uint32_t num_nodes;
+    uint32_t * neighbor_offsets;
+    uint32_t * neighbors;
+    uint32_t * neighbor_weights;
+    uint32_t * region_that_arrived_top;
+    uint32_t * wrapped_radius_cached;
+    uint64_t * radius;
+    engine_isa isa;
+
+    std::vector<uint32_t> best_neighbor;
+    std::vector<uint64_t> best_time;
+    std::vector<uint32_t> version;
+    std::priority_queue<frontier_entry, std::vector<frontier_entry>, frontier_entry_later> queue;
+
+    // nodes of the current update, each listed once
+    std::vector<uint32_t> batch;
+    std::vector<uint8_t> in_batch;
+    std::vector<uint32_t> batch_neighbor;
+    std::vector<uint64_t> batch_time;
+
+    // nodes recomputed by the last update
+    uint64_t num_recomputed;
+
+    event_frontier(uint32_t num_nodes, uint32_t * neighbor_offsets, uint32_t * neighbors, uint32_t * neighbor_weights,
+        uint32_t * region_that_arrived_top, uint32_t * wrapped_radius_cached, uint64_t * radius);
+
+    // Recomputes every node, e.g. after a full upload of the arrays.
+    next_event recompute_all(uint32_t time_bits);
+    // Recomputes the nodes owned by the changed regions, the changed nodes,
+    // and the neighbors of both. region_nodes is state_patches::region_nodes.
+    next_event update(const std::vector<std::vector<uint32_t> > & region_nodes,
+        const uint32_t * changed_regions, uint32_t num_changed_regions,
+        const uint32_t * changed_nodes, uint32_t num_changed_nodes, uint32_t time_bits);
+    next_event minimum();
+
+    void add(uint32_t node);
+    void run_batch(uint32_t time_bits);
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include "flooder.h"
+#include <algorithm>
+
+#define UNVISITED ((uint32_t) -1)
+
+flooder::flooder(uint32_t num_nodes, uint32_t * neighbor_offsets, uint32_t * neighbors, uint32_t * neighbor_weights,
+        uint64_t * neighbor_observables)
+    : num_nodes(num_nodes),
+      neighbor_offsets(neighbor_offsets),
+      neighbors(neighbors),
+      neighbor_weights(neighbor_weights),
+      neighbor_observables(neighbor_observables),
+      radius(num_nodes, 0),
+      region_that_arrived_top(num_nodes, NO_REGION),
+      wrapped_radius_cached(num_nodes, 0),
+      version(num_nodes, 0),
+      source(num_nodes, NO_REGION),
+      reached_from(num_nodes, NO_REGION),
+      path_observables(num_nodes, 0),
+      region_parity(num_nodes, 0),
+      region_boundary(num_nodes, 0),
+      region_nodes(num_nodes),
+      num_regions(0),
+      now(0),
+      isa(engine_detect()),
+      num_queries(0),
+      num_events(0),
+      observables(0) {}
+
+void flooder::reset() {
+    for (uint32_t node : touched) {
+        region_that_arrived_top[node] = NO_REGION;
+        wrapped_radius_cached[node] = 0;
+        source[node] = NO_REGION;
+        reached_from[node] = NO_REGION;
+        path_observables[node] = 0;
+    }
+    for (uint32_t region = 0; region < num_regions; region++) {
+        region_nodes[region].clear();
+    }
+    touched.clear();
+    collisions.clear();
+    scratch.reset();
+    while (!queue.empty()) {
+        queue.pop();
+    }
+    now = 0;
+    num_queries = 0;
+    num_events = 0;
+    observables = 0;
+}
+
+// Radius of a region at the current time, still shifted down by WRAPPED_RADIUS_BIAS.
+int64_t flooder::region_value(uint32_t region) const {
+    uint64_t rad = radius[region];
+    int64_t y = (int64_t) rad >> 2;
+    return (rad & 1) ? y + (int64_t) now : y;
+}
+
+// Local radius of an occupied node at the current time.
+int64_t flooder::local_value(uint32_t node) const {
+    return region_value(region_that_arrived_top[node]) + (int64_t) wrapped_radius_cached[node];
+}
+
+// Switches a region between growing and frozen without moving its current
+// radius. Regions never shrink, so the shrinking flag (2) is never set.
+void flooder::set_region_growth(uint32_t region, bool growing) {
+    int64_t value = region_value(region);
+    int64_t y = growing ? value - (int64_t) now : value;
+    radius[region] = ((uint64_t) y << 2) | (growing ? 1 : 0);
+}
+
+void flooder::schedule(uint32_t node, uint32_t neighbor_index, uint64_t time) {
+    if (time == (uint64_t) MAX) {
+        return;
+    }
+    // Round up to the flooder's integer clock and never schedule into the past:
+    // the queue only ever moves forward.
+    time = (time + WEIGHT_SCALE - 1) / WEIGHT_SCALE;
+    if (time < now) {
+        time = now;
+    }
+    queue.push({time, node, neighbor_index, version[node]});
+}
+
+void flooder::reschedule(uint32_t node) {
+    version[node]++;
+    auto next = find_next_event_at_node_returning_neighbor_index_and_time(node, neighbor_offsets, neighbors, neighbor_weights,
+        region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data());
+    num_queries++;
+    schedule(node, (uint32_t) next.first, next.second);
+}
+
+// Recomputes every node collected in batch with one engine call. A node listed
+// twice gets two events, of which only the later version survives.
+void flooder::reschedule_batch() {
+    uint32_t n = batch.size();
+    batch_neighbor.resize(n);
+    batch_time.resize(n);
+    // the biased radius words (WRAPPED_RADIUS_BIAS) need the full width
+    engine_find_next_events(isa, 64, n, batch.data(), neighbor_offsets, neighbors, neighbor_weights,
+        region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data(), batch_neighbor.data(), batch_time.data());
+    num_queries += n;
+    for (uint32_t j = 0; j < n; j++) {
+        version[batch[j]]++;
+    }
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t node = batch[j];
+        schedule(node, batch_neighbor[j], batch_time[j]);
+    }
+    batch.clear();
+}
+
+// A region changed growth or membership: every node it owns and every node
+// next to it may now see a different next event.
+void flooder::reschedule_region(uint32_t region) {
+    for (uint32_t node : region_nodes[region]) {
+        batch.push_back(node);
+        for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+            uint32_t neighbor = neighbors[e];
+            if (neighbor != BOUNDARY_NODE && region_that_arrived_top[neighbor] != region) {
+                batch.push_back(neighbor);
+            }
+        }
+    }
+    reschedule_batch();
+}
+
+// from is the occupied end of edge, an edge index out of either node.
+void flooder::claim(uint32_t node, uint32_t region, uint32_t from, uint32_t edge) {
+    region_that_arrived_top[node] = region;
+    // the region arrives with zero local radius at the node
+    wrapped_radius_cached[node] = (uint32_t) -region_value(region);
+    source[node] = source[from];
+    reached_from[node] = from;
+    path_observables[node] = path_observables[from] ^ neighbor_observables[edge];
+    region_nodes[region].push_back(node);
+    touched.push_back(node);
+
+    batch.push_back(node);
+    for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+        uint32_t neighbor = neighbors[e];
+        if (neighbor != BOUNDARY_NODE) {
+            batch.push_back(neighbor);
+        }
+    }
+    reschedule_batch();
+}
+
+void flooder::merge(uint32_t node_a, uint32_t node_b, uint32_t edge) {
+    collisions.push_back({source[node_a], source[node_b], node_a, node_b,
+        path_observables[node_a] ^ neighbor_observables[edge] ^ path_observables[node_b]});
+
+    uint32_t big = region_that_arrived_top[node_a];
+    uint32_t small = region_that_arrived_top[node_b];
+    if (region_nodes[big].size() < region_nodes[small].size()) {
+        std::swap(big, small);
+    }
+
+    region_parity[big] ^= region_parity[small];
+    region_boundary[big] |= region_boundary[small];
+    set_region_growth(big, region_parity[big] && !region_boundary[big]);
+
+    // Move the smaller region's nodes under the bigger one, keeping their local radius
+    for (uint32_t node : region_nodes[small]) {
+        int64_t value = local_value(node);
+        region_that_arrived_top[node] = big;
+        wrapped_radius_cached[node] = (uint32_t) (value - region_value(big));
+        region_nodes[big].push_back(node);
+    }
+    region_nodes[small].clear();
+    radius[small] = 0;
+
+    reschedule_region(big);
+}
+
+void flooder::hit_boundary(uint32_t node, uint32_t edge) {
+    uint32_t region = region_that_arrived_top[node];
+    collisions.push_back({source[node], BOUNDARY_NODE, node, BOUNDARY_NODE,
+        path_observables[node] ^ neighbor_observables[edge]});
+    region_boundary[region] = 1;
+    set_region_growth(region, false);
+    reschedule_region(region);
+}
+
+void flooder::process(const flood_event & event) {
+    if (event.version != version[event.node]) {
+        return;
+    }
+    now = event.time;
+    num_events++;
+
+    uint32_t node = event.node;
+    uint32_t edge = neighbor_offsets[node] + event.neighbor_index;
+    uint32_t neighbor = neighbors[edge];
+    if (neighbor == BOUNDARY_NODE) {
+        hit_boundary(node, edge);
+        return;
+    }
+
+    uint32_t region = region_that_arrived_top[node];
+    uint32_t neighbor_region = region_that_arrived_top[neighbor];
+    if (region == NO_REGION) {
+        claim(node, neighbor_region, neighbor, edge);
+    } else if (neighbor_region == NO_REGION) {
+        claim(neighbor, region, node, edge);
+    } else if (region != neighbor_region) {
+        merge(node, neighbor, edge);
+    } else {
+        reschedule(node);
+    }
+}
+
+bool flooder::decode(const uint32_t * detection_events, uint32_t num_detection_events, std::vector<match> & matches) {
+    reset();
+    matches.clear();
+    num_regions = num_detection_events;
+
+    // Region k starts at detection event k with zero radius, growing
+    for (uint32_t k = 0; k < num_detection_events; k++) {
+        uint32_t node = detection_events[k];
+        radius[k] = ((uint64_t) -(int64_t) WRAPPED_RADIUS_BIAS << 2) | 1;
+        region_parity[k] = 1;
+        region_boundary[k] = 0;
+        region_nodes[k].push_back(node);
+        region_that_arrived_top[node] = k;
+        wrapped_radius_cached[node] = WRAPPED_RADIUS_BIAS;
+        source[node] = k;
+        reached_from[node] = node;
+        path_observables[node] = 0;
+        touched.push_back(node);
+    }
+    batch.assign(detection_events, detection_events + num_detection_events);
+    reschedule_batch();
+
+    while (!queue.empty()) {
+        flood_event event = queue.top();
+        queue.pop();
+        process(event);
+    }
+
+    return pair_up(detection_events, num_detection_events, matches);
+}
+
+// The collisions form a forest over the detection events, with at most one
+// boundary edge per merged region. Walking each tree bottom-up and pairing
+// whatever is left unmatched in a subtree yields a perfect matching whenever
+// every tree is even or touches the boundary. A matched pair's path is the
+// tree path between them, so a collision's observables are flipped once for
+// every pending event carried across it.
+bool flooder::pair_up(const uint32_t * detection_events, uint32_t num_detection_events, std::vector<match> & matches) {
+    uint32_t boundary = num_detection_events;
+    uint32_t num_vertices = num_detection_events + 1;
+    uint32_t num_collisions = collisions.size();
+
+    // Collision graph in compressed rows, each vertex's collisions in order
+    uint32_t * adjacent_offsets = scratch.alloc<uint32_t>(num_vertices + 1);
+    uint32_t * adjacent_vertex = scratch.alloc<uint32_t>(2 * num_collisions);
+    uint32_t * adjacent_collision = scratch.alloc<uint32_t>(2 * num_collisions);
+    std::fill(adjacent_offsets, adjacent_offsets + num_vertices + 1, 0);
+    for (uint32_t c = 0; c < num_collisions; c++) {
+        uint32_t b = (collisions[c].source_b == BOUNDARY_NODE) ? boundary : collisions[c].source_b;
+        adjacent_offsets[collisions[c].source_a + 1]++;
+        adjacent_offsets[b + 1]++;
+    }
+    for (uint32_t v = 0; v < num_vertices; v++) {
+        adjacent_offsets[v + 1] += adjacent_offsets[v];
+    }
+    uint32_t * fill = scratch.alloc<uint32_t>(num_vertices);
+    std::copy(adjacent_offsets, adjacent_offsets + num_vertices, fill);
+    for (uint32_t c = 0; c < num_collisions; c++) {
+        uint32_t a = collisions[c].source_a;
+        uint32_t b = (collisions[c].source_b == BOUNDARY_NODE) ? boundary : collisions[c].source_b;
+        adjacent_vertex[fill[a]] = b;
+        adjacent_collision[fill[a]++] = c;
+        adjacent_vertex[fill[b]] = a;
+        adjacent_collision[fill[b]++] = c;
+    }
+
+    // every vertex is pushed once, when its parent is set
+    uint32_t * parent = scratch.alloc<uint32_t>(num_vertices);
+    uint32_t * parent_collision = scratch.alloc<uint32_t>(num_vertices);
+    uint32_t * order = scratch.alloc<uint32_t>(num_vertices);
+    uint32_t * stack = scratch.alloc<uint32_t>(num_vertices);
+    std::fill(parent, parent + num_vertices, UNVISITED);
+    std::fill(parent_collision, parent_collision + num_vertices, UNVISITED);
+    uint32_t order_size = 0;
+    for (uint32_t root = boundary + 1; root-- > 0;) {
+        if (parent[root] != UNVISITED) {
+            continue;
+        }
+        parent[root] = root;
+        uint32_t stack_size = 0;
+        stack[stack_size++] = root;
+        while (stack_size > 0) {
+            uint32_t v = stack[--stack_size];
+            order[order_size++] = v;
+            for (uint32_t e = adjacent_offsets[v]; e < adjacent_offsets[v + 1]; e++) {
+                uint32_t u = adjacent_vertex[e];
+                if (parent[u] == UNVISITED) {
+                    parent[u] = v;
+                    parent_collision[u] = adjacent_collision[e];
+                    stack[stack_size++] = u;
+                }
+            }
+        }
+    }
+
+    uint32_t * pending = scratch.alloc<uint32_t>(num_vertices);
+    for (uint32_t k = 0; k < num_detection_events; k++) {
+        pending[k] = k;
+    }
+    pending[boundary] = UNVISITED;
+    bool matched = true;
+    for (size_t j = order_size; j-- > 0;) {
+        uint32_t v = order[j];
+        uint32_t p = parent[v];
+        if (pending[v] == UNVISITED) {
+            continue;
+        }
+        if (p == v) {
+            // only the boundary may absorb a leftover detection event
+            matched = matched && (v == boundary);
+            continue;
+        }
+        observables ^= collisions[parent_collision[v]].observables;
+        if (p == boundary) {
+            matches.push_back({detection_events[pending[v]], BOUNDARY_NODE});
+        } else if (pending[p] == UNVISITED) {
+            pending[p] = pending[v];
+        } else {
+            matches.push_back({detection_events[pending[p]], detection_events[pending[v]]});
+            pending[p] = UNVISITED;
+        }
+    }
+    return matched;
+}
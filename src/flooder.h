@@ -0,0 +1,134 @@
+#ifndef FLOODER_H
+#define FLOODER_H
+
+#include <stdint.h>
+#include <queue>
+#include <vector>
+#include "next_event.h"
+#include "engine.h"
+#include "arena.h"
+
+#define BOUNDARY_NODE ((uint32_t) -1)
+#define NO_REGION ((uint32_t) -1)
+
+// wrapped_radius_cached is unsigned and is shifted into the radius word without
+// sign extension, so the flooder stores every region y-intercept shifted down by
+// this bias and every node offset shifted up by it. Their sum, the node's local
+// radius, is unaffected.
+#define WRAPPED_RADIUS_BIAS (1u << 29)
+
+// Edge weights in neighbor_weights are in the units of the next-event
+// functions, which subtract (rad >> 2) << 2: four times the flooder's integer
+// time. Use even flooder weights (multiples of 8 here) so collisions between
+// two growing regions land on integer times.
+#define WEIGHT_SCALE 4
+
+// One pair of the final matching; b is BOUNDARY_NODE when a is matched to the boundary.
+struct match {
+    uint32_t a;
+    uint32_t b;
+};
+
+struct flood_event {
+    uint64_t time;
+    uint32_t node;
+    uint32_t neighbor_index;
+    uint32_t version;
+};
+
+struct flood_event_later {
+    bool operator()(const flood_event & x, const flood_event & y) const {
+        return x.time > y.time || (x.time == y.time && x.node > y.node);
+    }
+};
+
+// Two regions (or a region and the boundary) that met along edge (node_a, node_b).
+// source_a/source_b are the detection events whose growth reached each side;
+// observables is the mask flipped by the path between them through that edge.
+struct collision {
+    uint32_t source_a;
+    uint32_t source_b;
+    uint32_t node_a;
+    uint32_t node_b;
+    uint64_t observables;
+};
+
+// Event-driven flooder around find_next_event_at_node_returning_neighbor_index_and_time.
+// Every detection event starts a growing region. Regions that touch are merged;
+// a merged region keeps growing while it holds an odd number of detection events
+// and has not reached the boundary, and is frozen otherwise. When no region grows
+// any more the detection events are paired along the tree of collisions that
+// merged them, and the observables flipped by that matching are accumulated.
+// This is union-find clustering, not blossom matching: there are no
+// alternating trees and no shrink phase, so no region ever shrinks and the
+// shrinking branch of the next-event functions is never taken from here.
+struct flooder {
+    uint32_t num_nodes;
+    uint32_t * neighbor_offsets;
+    uint32_t * neighbors;
+    uint32_t * neighbor_weights;
+    uint64_t * neighbor_observables;
+
+    // the arrays the next-event functions read; regions are numbered by detection event
+    std::vector<uint64_t> radius;
+    std::vector<uint32_t> region_that_arrived_top;
+    std::vector<uint32_t> wrapped_radius_cached;
+
+    // per node: event version (stale queue entries are skipped), growth tree
+    // and the observables along the tree path back to its source
+    std::vector<uint32_t> version;
+    std::vector<uint32_t> source;
+    std::vector<uint32_t> reached_from;
+    std::vector<uint64_t> path_observables;
+
+    // per region, only meaningful for regions that have not been merged away
+    std::vector<uint32_t> region_parity;
+    std::vector<uint8_t> region_boundary;
+    std::vector<std::vector<uint32_t> > region_nodes;
+    uint32_t num_regions;
+
+    std::vector<collision> collisions;
+    std::priority_queue<flood_event, std::vector<flood_event>, flood_event_later> queue;
+    std::vector<uint32_t> touched;
+    uint64_t now;
+
+    // nodes whose next event is recomputed together in one engine call
+    engine_isa isa;
+    std::vector<uint32_t> batch;
+    std::vector<uint32_t> batch_neighbor;
+    std::vector<uint64_t> batch_time;
+
+    // per-shot scratch of pair_up, handed back by reset()
+    arena scratch;
+
+    // counters for the last decode
+    uint64_t num_queries;
+    uint64_t num_events;
+
+    // observables flipped by the last decode's matching: the logical prediction
+    uint64_t observables;
+
+    flooder(uint32_t num_nodes, uint32_t * neighbor_offsets, uint32_t * neighbors, uint32_t * neighbor_weights,
+        uint64_t * neighbor_observables);
+
+    // Floods from the detection events and writes the resulting matching (in
+    // detector node ids). Returns false if some region could never be matched,
+    // e.g. an odd number of detection events in a component without boundary.
+    bool decode(const uint32_t * detection_events, uint32_t num_detection_events, std::vector<match> & matches);
+
+    void reset();
+    int64_t region_value(uint32_t region) const;
+    int64_t local_value(uint32_t node) const;
+    void set_region_growth(uint32_t region, bool growing);
+    void schedule(uint32_t node, uint32_t neighbor_index, uint64_t time);
+    void reschedule(uint32_t node);
+    void reschedule_batch();
+    void reschedule_region(uint32_t region);
+    void claim(uint32_t node, uint32_t region, uint32_t from, uint32_t edge);
+    void merge(uint32_t node_a, uint32_t node_b, uint32_t edge);
+    void hit_boundary(uint32_t node, uint32_t edge);
+    void process(const flood_event & event);
+    bool pair_up(const uint32_t * detection_events, uint32_t num_detection_events, std::vector<match> & matches);
+};
+
+#endif
@@ -23,7 +23,6 @@
 ******************************************/
 
 #include <fstream>
-#include "xcl2.hpp"
 #include <algorithm>
 #include <iostream>
 #include <stdint.h>
@@ -35,541 +34,499 @@
 #include <time.h>
 #include <chrono>
 #include <cstdint>
+#include "next_event.h"
+#include "engine.h"
+#include "state_patches.h"
+#include "event_cache.h"
+#include "event_frontier.h"
+#include "dem.h"
+#include "dispatcher.h"
+#include "backend.h"
 
-#define NUM_NODES 100
-#define NUM_NEIGHBORS 2
-#define NUM_REGIONS 10
-#define MAX 9223372036854775807
 #define PORT_WIDTH 32
 
-#define NUM_KERNEL 1
+// Compute units in the xclbin, must match nk=querk:<n> in querk.cfg
+#define NUM_KERNEL 3
+// Query batches handed to each worker per round, the rest is stolen
+#define SLICES_PER_WORKER 4
+#define BATCH_SIZE 1024
+#define NUM_ROUNDS 8
+#define DEFAULT_NUM_NODES 100
+#define DEFAULT_NUM_REGIONS 10
 
 #define NOW std::chrono::high_resolution_clock::now();
 
-#define MAX_HBM_BANKCOUNT 32
-#define BANK_NAME(n) n | XCL_MEM_TOPOLOGY
-const int bank[MAX_HBM_BANKCOUNT] = {
-    BANK_NAME(0),  BANK_NAME(1),  BANK_NAME(2),  BANK_NAME(3),  BANK_NAME(4),
-    BANK_NAME(5),  BANK_NAME(6),  BANK_NAME(7),  BANK_NAME(8),  BANK_NAME(9),
-    BANK_NAME(10), BANK_NAME(11), BANK_NAME(12), BANK_NAME(13), BANK_NAME(14),
-    BANK_NAME(15), BANK_NAME(16), BANK_NAME(17), BANK_NAME(18), BANK_NAME(19),
-    BANK_NAME(20), BANK_NAME(21), BANK_NAME(22), BANK_NAME(23), BANK_NAME(24),
-    BANK_NAME(25), BANK_NAME(26), BANK_NAME(27), BANK_NAME(28), BANK_NAME(29),
-    BANK_NAME(30), BANK_NAME(31)};
-
-
-std::pair<size_t, uint64_t > find_next_event_at_node_occupied_by_growing_top_region(
-	uint32_t detector_node,
-	uint64_t rad1,
-	uint32_t * num_neighbors,
-	uint32_t neighbors[][NUM_NEIGHBORS],
-	uint32_t neighbor_weights[][NUM_NEIGHBORS],
-	uint32_t * region_that_arrived_top,
-	uint32_t * wrapped_radius_cached,
-	uint64_t * radius)
-
-	{
-	uint64_t best_time = MAX;
-	uint32_t best_neighbor = MAX;
-	uint32_t start = 0;
-    if (!(num_neighbors[detector_node]==0) && neighbors[detector_node][0] == -1) {
-        // Growing towards boundary
-    	uint32_t weight = neighbor_weights[detector_node][0];
-    	uint64_t collision_time = weight - ((rad1 >> 2)<<2);
-        if (collision_time < best_time) {
-            best_time = collision_time;
-            best_neighbor = 0;
-        }
-        start++;
-    }
-
-    // Handle non-boundary neighbors.
-    for (uint32_t i = start; i < num_neighbors[detector_node]; i++) {
-        
-    	uint32_t weight = neighbor_weights[detector_node][i];
-
-    	uint32_t neighbor = neighbors[detector_node][i];
-
-        if (region_that_arrived_top[detector_node] == region_that_arrived_top[neighbor]) {
-            continue;
-        }
-        uint64_t rad2;
-
-		if (region_that_arrived_top[neighbor] == -1) {
-				rad2 = 0;
-		} else {
-			rad2 = radius[region_that_arrived_top[neighbor]] +(wrapped_radius_cached[neighbor] << 2);
-		}
-
-        if (rad2 & 2) {
-            continue;
-        }
-
-        uint64_t collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
-        if (rad2 & 1) {
-            collision_time >>= 1;
-        }
-        if (collision_time < best_time) {
-            best_time = collision_time;
-            best_neighbor = i;
-        }
-    }
-    return {best_neighbor, best_time};
-}
-
-std::pair<size_t, uint64_t > find_next_event_at_node_not_occupied_by_growing_top_region(
-	uint32_t detector_node,
-	uint64_t rad1,
-	uint32_t * num_neighbors,
-	uint32_t neighbors[][NUM_NEIGHBORS],
-	uint32_t neighbor_weights[][NUM_NEIGHBORS],
-	uint32_t * region_that_arrived_top,
-	uint32_t * wrapped_radius_cached,
-	uint64_t * radius)
-
-{
-	uint64_t best_time = MAX;
-	uint32_t best_neighbor = MAX;
-
-	uint32_t start = 0;
-    if (!(num_neighbors[detector_node]==0) && neighbors[detector_node][0] == -1)
-        start++;
-
-    // Handle non-boundary neighbors.
-    for (uint32_t i = start; i < num_neighbors[detector_node]; i++) {
-        
-    	uint32_t weight = neighbor_weights[detector_node][i];
-
-    	uint32_t neighbor = neighbors[detector_node][i];
-
-    	uint64_t rad2;
-
-		if (region_that_arrived_top[neighbor] == -1) {
-				rad2 = 0;
-		} else {
-			rad2 = radius[region_that_arrived_top[neighbor]] +(wrapped_radius_cached[neighbor] << 2);
-		}
-
-        if (rad2 & 1) {
-            auto collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
-            if (collision_time < best_time) {
-                best_time = collision_time;
-                best_neighbor = i;
-            }
-        }
-    }
-    return {best_neighbor, best_time};
-}
-
-std::pair<size_t, uint64_t > find_next_event_at_node_returning_neighbor_index_and_time(
-    uint32_t detector_node,
-	uint32_t * num_neighbors,
-	uint32_t neighbors[][NUM_NEIGHBORS],
-	uint32_t neighbor_weights[][NUM_NEIGHBORS],
-	uint32_t * region_that_arrived_top,
-	uint32_t * wrapped_radius_cached,
-	uint64_t * radius)
-{
-	uint64_t rad1;
-
-	if (region_that_arrived_top[detector_node] == -1) {
-			rad1 = 0;
-	} else {
-		rad1 = radius[region_that_arrived_top[detector_node]] + (wrapped_radius_cached[detector_node] << 2);
-	}
-
-
-    if (rad1 & 1) {
-        return find_next_event_at_node_occupied_by_growing_top_region(detector_node, rad1, num_neighbors, neighbors, neighbor_weights, region_that_arrived_top, wrapped_radius_cached, radius);
-    } else {
-        return find_next_event_at_node_not_occupied_by_growing_top_region(detector_node, rad1, num_neighbors, neighbors, neighbor_weights, region_that_arrived_top, wrapped_radius_cached, radius);
-    }
-}
-
-
 int main(int argc, char *argv[]){
     
     std::string binaryFile = "querk.xclbin";
 	std::string readsPath;
+
+    uint32_t num_queries = BATCH_SIZE;
+    uint32_t num_nodes = DEFAULT_NUM_NODES;
+    uint32_t num_regions = DEFAULT_NUM_REGIONS;
+    bool packed = false;
 	
-    cl::Context context;
- 
-    cl::CommandQueue commands;
-    std::vector<uint32_t, aligned_allocator<uint32_t>> num_neighbors(NUM_NODES);
-    num_neighbors = {1,1};
-    std::vector<uint64_t, aligned_allocator<uint64_t>> radius(NUM_REGIONS);
-    radius = {1,1};
-    std::vector<uint32_t, aligned_allocator<uint32_t>> region_that_arrived_top(NUM_NODES);
-    region_that_arrived_top = {0,1};
-    std::vector<uint32_t, aligned_allocator<uint32_t>> wrapped_radius_cached(NUM_NODES);
-    wrapped_radius_cached = {1,1};
-    std::vector<uint32_t, aligned_allocator<uint32_t>> neighbors(NUM_NODES*NUM_NEIGHBORS);
-    neighbors = {1,0};
-    std::vector<uint32_t, aligned_allocator<uint32_t>> neighbor_weights(NUM_NODES*NUM_NEIGHBORS);
-    neighbor_weights = {1,1};
-    std::vector<uint64_t, aligned_allocator<uint64_t>> neighbor_observables(NUM_NODES*NUM_NEIGHBORS);
-    neighbor_observables = {0,0};
-    std::vector<uint32_t, aligned_allocator<uint32_t>> out_neighbor(1);
-    out_neighbor = {-1};
-    std::vector<uint64_t, aligned_allocator<uint64_t>> out_time(1);
-    out_time = {-1};
-
-    uint32_t detector_node = 0;
-    uint32_t num_nodes = 2;
-    uint32_t num_regions = 2;
-	
-    if (argc == 3) { //Input provided by file 
+    // querk_final <backend> [dem file, or - for the built-in test graph] [num_queries] [num_nodes] [num_regions] [split|packed]
+    // where backend is an xclbin, or one of cpu[:threads] (engine), golden[:threads]
+    // kernel[:threads] (the kernel code on the CPU) and stream[:threads] (the
+    // free-running kernel on the CPU, packed layout only) to run without a card
+    if (argc >= 3) { //Input provided by file 
 
         binaryFile = argv[1];
         readsPath = argv[2];
     } else {
          binaryFile = argv[1];
     }   
-    //     std::ifstream st(readsPath);
-	//     std::string temp1;
-	//     std::string temp2;
-	    
-    //     int idx = 0;
-    //     while (st >> temp1 >> temp2){ //Reading input from file 
-	// 	    std::string temp;
-	// 	    temp = temp1.substr(1,std::string::npos);
-	// 	    pattern_test[idx] = temp;
-	// 	    temp = temp2.substr(1,std::string::npos);
-    //         text_test[idx] = temp;
-    //         idx++;
-	//     }
-
-    //     num = idx;
-
-    //     for (int i=0; i<NUM; i++){ //Storing lengths
-    //         patternLength[i] = pattern_test[i].size();
-    //         textLength[i] = text_test[i].size();
-    //         if (i>=num){
-    //             patternLength[i] = 0;
-    //             textLength[i] = 0;
-    //         }
-    //     }
-
-    //     int iter_pattern = 0;
-    //     int iter_text = 0;
-    //     for (int i=0; i<num; i++){ //Reorganizing inputs for the core
-            
-    //         for (int j=0; j<pattern_test[i].size(); j++){
-    //             pattern[iter_pattern] = pattern_test[i][j];
-    //             iter_pattern++;
-    //         }
-            
-    //         for (int k=0; k<text_test[i].size(); k++){
-    //             text[iter_text] = text_test[i][k];
-    //             iter_text++;
-    //         }
-    //     }
-    
-    // } else { //Random generation of inputs
- 
-    //     binaryFile = argv[1];
-
-    //     std::cout<<"Seed: "<<seed<<std::endl;
-	//     srand(seed);
-
-	//     char alphabet[4] = {'A', 'C', 'G', 'T'};
-
-	//     int iter = 0; 
-	//     for (int i = 0; i < num; i++) {
-	// 	    for (int j = 0; j < TEXT_SIZE; j++) {
-	// 		    text_test[i].push_back(alphabet[rand()%4]);
-	// 		    text[iter]=text_test[i][j];
-	// 		    iter++;
-	// 	    }
-	//     }
-
-	//     iter = 0;
-	//     for (int i = 0; i < num; i++) {
-	// 	    for (int j = 0; j < PATTERN_SIZE; j++) {
-	// 		    pattern_test[i].push_back(alphabet[rand()%4]);
-	// 		    pattern[iter] = pattern_test[i][j];
-	// 		    iter++;
-	// 	    }
-	//     }
-
-	//     for (int i = 0; i < num; i++) {
-	// 	    patternLength[i] = PATTERN_SIZE;
-	// 	    textLength[i] = TEXT_SIZE;
-	//     }
-    // }
-
-    // // Set penalties
-	// affine_penalties_t affine_penalties = {
-	// 	.match = 0,
-	// 	.mismatch = 3,
-	// 	.gap_opening = 5,
-	// 	.gap_extension = 1,
-	// };
-
-	// if ((affine_penalties.mismatch-affine_penalties.gap_extension) != (affine_penalties.gap_opening-affine_penalties.mismatch)) {
-	// 	std::cout<<"Error: unsupported penalties!"<<std::endl;
-	// 	std::cout<<"Must satisfy: (mismatch - gap extension) == (gap opening - mismatch)"<<std::endl;
-	// 	std::cout<<"Test failed"<<std::endl;
-	// 	exit(1);
-	// }
-
-	// printf("PENALTIES INITIALIZED: %d, %d, %d, %d \n", affine_penalties.match, affine_penalties.mismatch, affine_penalties.gap_opening, affine_penalties.gap_extension);
-
-    std::string krnl_name = "querk";
-    cl::Kernel krnl;
-
-    // The get_xil_devices will return vector of Xilinx Devices
-    auto devices = xcl::get_xil_devices();
-
-    // read_binary_file() command will find the OpenCL binary file created using the
-    // V++ compiler load into OpenCL Binary and return pointer to file buffer.
-    auto fileBuf = xcl::read_binary_file(binaryFile);
-
-    cl::Program::Binaries bins{{fileBuf.data(), fileBuf.size()}};
-    int valid_device = 0;
-
-    cl_int err;
-
-    for (unsigned int i = 0; i < devices.size(); i++) {
-        auto device = devices[i];
-            // Creating Context and Command Queue for selected Device
-        OCL_CHECK(err, context = cl::Context(device, NULL, NULL, NULL, &err));
-        OCL_CHECK(err, commands = cl::CommandQueue(context, device,
-                            CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE, &err));
-
-        std::cout << "Trying to program device[" << i 
-                  << "]: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
-     
-        cl::Program program(context, {device}, bins, NULL, &err);
-        
-        if (err != CL_SUCCESS) {
-            std::cout << "Failed to program device[" << i
-                        << "] with xclbin file!\n";                      
-        } else {
-            std::cout << "Device[" << i << "]: program successful!\n";
-            
-            // Creating Kernel object using Compute unit names
-            
-            std::string cu_id = std::to_string(1);
-            std::string krnl_name_full = krnl_name + ":{" + "querk_" + cu_id + "}";
-
-            printf("Creating a kernel [%s] for CU(%d)\n", krnl_name_full.c_str(),  1);
-
-            //Here Kernel object is created by specifying kernel name along with compute unit.
-            //For such case, this kernel object can only access the specific Compute unit
-            OCL_CHECK(err, krnl = cl::Kernel(program, krnl_name_full.c_str(), &err));
-            
-
-            valid_device++;
-            break; // we break because we found a valid device
-        }
-        std::cout<<"dwvgae"<<std::endl;
+    if (argc >= 4) {
+        num_queries = atoi(argv[3]);
     }
-
-	std::cout<<"Kernel created"<<std::endl;
-    
-    if (valid_device == 0) {
-        std::cout << "Failed to program any device found, exit!\n";
-        exit(EXIT_FAILURE);
+    if (argc >= 5) {
+        num_nodes = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        num_regions = atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        packed = std::string(argv[6]) == "packed";
     }
 
-    // Create device buffers
-    cl_mem_ext_ptr_t num_neighbors_ext;
-    cl_mem_ext_ptr_t radius_ext;
-    cl_mem_ext_ptr_t region_that_arrived_top_ext;
-    cl_mem_ext_ptr_t wrapped_radius_cached_ext;
-    cl_mem_ext_ptr_t neighbors_ext;
-    cl_mem_ext_ptr_t neighbor_weights_ext;
-    cl_mem_ext_ptr_t neighbor_observables_ext;
-    cl_mem_ext_ptr_t out_neighbor_ext;
-    cl_mem_ext_ptr_t out_time_ext;
-    cl::Buffer num_neighbors_buffer;
-    cl::Buffer radius_buffer;
-    cl::Buffer region_that_arrived_top_buffer;
-    cl::Buffer wrapped_radius_cached_buffer;
-    cl::Buffer neighbors_buffer;
-    cl::Buffer neighbor_weights_buffer;
-    cl::Buffer neighbor_observables_buffer;
-    cl::Buffer out_neighbor_buffer;
-    cl::Buffer out_time_buffer;
-
-
-    num_neighbors_ext.obj = num_neighbors.data();
-    num_neighbors_ext.param = 0;
-    num_neighbors_ext.flags = bank[0];
-
-    radius_ext.obj = radius.data();
-    radius_ext.param = 0;
-    radius_ext.flags = bank[1];
-    
-    region_that_arrived_top_ext.obj = region_that_arrived_top.data();
-    region_that_arrived_top_ext.param = 0;
-    region_that_arrived_top_ext.flags = bank[2];
-
-    wrapped_radius_cached_ext.obj = wrapped_radius_cached.data();
-    wrapped_radius_cached_ext.param = 0;
-    wrapped_radius_cached_ext.flags = bank[3];
-
-    neighbors_ext.obj = neighbors.data();
-    neighbors_ext.param = 0;
-    neighbors_ext.flags = bank[4];
-
-    neighbor_weights_ext.obj = neighbor_weights.data();
-    neighbor_weights_ext.param = 0;
-    neighbor_weights_ext.flags = bank[5];
-    
-    neighbor_observables_ext.obj = neighbor_observables.data();
-    neighbor_observables_ext.param = 0;
-    neighbor_observables_ext.flags = bank[6];
-
-    out_neighbor_ext.obj = out_neighbor.data();
-    out_neighbor_ext.param = 0;
-    out_neighbor_ext.flags = bank[7];
-
-    out_time_ext.obj = out_time.data();
-    out_time_ext.param = 0;
-    out_time_ext.flags = bank[8];
-
-    
-
-    OCL_CHECK(err, num_neighbors_buffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int)*NUM_NODES, &num_neighbors_ext, &err));
-    OCL_CHECK(err, radius_buffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(long int)*NUM_REGIONS, &radius_ext, &err));
-    OCL_CHECK(err, region_that_arrived_top_buffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int)*NUM_NODES, &region_that_arrived_top_ext, &err));
-    OCL_CHECK(err, wrapped_radius_cached_buffer = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int)*NUM_NODES, &wrapped_radius_cached_ext, &err));
-    OCL_CHECK(err, neighbors_buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int)*NUM_NODES*NUM_NEIGHBORS, &neighbors_ext, &err));
-	
-    OCL_CHECK(err, neighbor_weights_buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int)*NUM_NODES*NUM_NEIGHBORS, &neighbor_weights_ext, &err));
+    std::string backend_kind = binaryFile.substr(0, binaryFile.find(':'));
+    bool use_cpu = backend_kind == "cpu" || backend_kind == "golden" || backend_kind == "kernel" || backend_kind == "stream";
+    uint32_t num_workers = NUM_KERNEL;
+    if (use_cpu) {
+        num_workers = binaryFile.size() > backend_kind.size() + 1 ? atoi(binaryFile.c_str() + backend_kind.size() + 1) : std::thread::hardware_concurrency();
+    }
 
-    OCL_CHECK(err, neighbor_observables_buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(long int)*NUM_NODES*NUM_NEIGHBORS, &neighbor_observables_ext, &err));
+    std::vector<uint32_t> neighbor_offsets;
+    std::vector<uint32_t> neighbors;
+    std::vector<uint32_t> neighbor_weights;
+    std::vector<uint64_t> neighbor_observables;
+    // Everything below the loader speaks node ids; detectors are translated
+    // through this map on the way in and out
+    node_permutation order;
+
+    if (!readsPath.empty() && readsPath != "-") {
+        // Graph from a detector error model; num_nodes comes from the file
+        dem_graph graph;
+        std::chrono::high_resolution_clock::time_point start = NOW;
+        if (!load_dem(readsPath.c_str(), 1, graph)) {
+            printf("Test failed\n");
+            exit(1);
+        }
+        std::chrono::high_resolution_clock::time_point end = NOW;
+        std::chrono::duration<double> time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
+        printf("Loaded %s in %lf s: %u detectors, %lu edge slots, %lu errors (%lu merged, %lu hyperedges dropped)\n",
+            readsPath.c_str(), time.count(), graph.num_nodes, (unsigned long) graph.neighbors.size(),
+            (unsigned long) graph.num_errors, (unsigned long) graph.num_merged, (unsigned long) graph.num_hyperedges);
+        uint32_t max_distance;
+        double mean_distance;
+        csr_bandwidth(graph.num_nodes, graph.neighbor_offsets.data(), graph.neighbors.data(), max_distance, mean_distance);
+        start = NOW;
+        reorder_dem_nodes(graph);
+        end = NOW;
+        time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
+        printf("Reordered nodes in %lf s: neighbor distance max %u mean %.1f", time.count(), max_distance, mean_distance);
+        csr_bandwidth(graph.num_nodes, graph.neighbor_offsets.data(), graph.neighbors.data(), max_distance, mean_distance);
+        printf(" -> max %u mean %.1f\n", max_distance, mean_distance);
+        num_nodes = graph.num_nodes;
+        order = graph.order;
+        neighbor_offsets.assign(graph.neighbor_offsets.begin(), graph.neighbor_offsets.end());
+        neighbors.assign(graph.neighbors.begin(), graph.neighbors.end());
+        neighbor_weights.assign(graph.neighbor_weights.begin(), graph.neighbor_weights.end());
+        neighbor_observables.assign(graph.neighbor_observables.begin(), graph.neighbor_observables.end());
+    } else if (num_nodes >= 2) {
+        // Test graph: a chain whose two end nodes have a boundary edge first, plus a
+        // skip edge from every fourth node so degrees are irregular.
+        neighbor_offsets.resize(num_nodes + 1);
+        for (uint32_t i = 0; i < num_nodes; i++) {
+            neighbor_offsets[i] = neighbors.size();
+            if (i == 0 || i == num_nodes - 1) {
+                neighbors.push_back((uint32_t) -1);
+            }
+            if (i > 0) {
+                neighbors.push_back(i - 1);
+            }
+            if (i < num_nodes - 1) {
+                neighbors.push_back(i + 1);
+            }
+            if (i % 4 == 0 && i + 2 < num_nodes) {
+                neighbors.push_back(i + 2);
+            }
+            if (i >= 2 && (i - 2) % 4 == 0) {
+                neighbors.push_back(i - 2);
+            }
+        }
+        neighbor_offsets[num_nodes] = neighbors.size();
+        neighbor_weights.resize(neighbors.size());
+        for (uint32_t e = 0; e < neighbors.size(); e++) {
+            neighbor_weights[e] = 16 + 4*(e % 5);
+        }
+        // every edge gets its own mask so a wrong edge cannot hide behind a tie
+        neighbor_observables.resize(neighbors.size());
+        for (uint32_t e = 0; e < neighbors.size(); e++) {
+            neighbor_observables[e] = (uint64_t) 1 << (e % 64);
+        }
+        identity_permutation(num_nodes, order);
+    }
+    uint32_t num_edges = neighbors.size();
+    std::vector<edge_record> edges(num_edges);
+    pack_edge_records(num_edges, neighbors.data(), neighbor_weights.data(), neighbor_observables.data(), edges.data());
 
-    OCL_CHECK(err, out_neighbor_buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX |
-                                CL_MEM_USE_HOST_PTR, sizeof(int), &out_neighbor_ext, &err));
-    
-    OCL_CHECK(err, out_time_buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX |
-                              CL_MEM_USE_HOST_PTR, sizeof(long int), &out_time_ext, &err));
+    if (num_nodes < 2 || num_edges == 0 || num_regions < 1 || num_workers < 1) {
+        printf("Error: need at least 2 nodes, 1 edge, 1 region and 1 worker\n");
+        printf("Test failed\n");
+        exit(1);
+    }
 
+    // Two out of three nodes are occupied, and the regions cycle through
+    // growing, shrinking and frozen.
+    std::vector<uint64_t> radius(num_regions);
+    std::vector<uint32_t> region_that_arrived_top(num_nodes);
+    std::vector<uint32_t> wrapped_radius_cached(num_nodes, 1);
+    for (uint32_t r = 0; r < num_regions; r++) {
+        radius[r] = ((uint64_t) r << 2) | (r % 3 == 2 ? 0 : r % 3 + 1);
+    }
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        region_that_arrived_top[order.to_internal[i]] = (i % 3 == 2) ? (uint32_t) -1 : i % num_regions;
+    }
 
+    // One batch cycles through all the detectors so every query has a golden counterpart
+    std::vector<uint32_t> detector_nodes(num_queries);
+    for (uint32_t q = 0; q < num_queries; q++) {
+        detector_nodes[q] = order.to_internal[q % num_nodes];
+    }
+    // QUERK_TOP_K candidates per query, the first being the next event
+    std::vector<uint32_t> out_neighbor(num_queries*QUERK_TOP_K, (uint32_t) -1);
+    std::vector<uint64_t> out_time(num_queries*QUERK_TOP_K, (uint64_t) -1);
+    std::vector<uint64_t> out_observables(num_queries*QUERK_TOP_K, (uint64_t) -1);
+    // Queries the cache could not answer, compacted for the device, and
+    // which query each of them is
+    std::vector<uint32_t> miss_nodes(num_queries);
+    std::vector<uint32_t> miss_queries(num_queries);
+    std::vector<uint32_t> miss_neighbor(num_queries*QUERK_TOP_K);
+    std::vector<uint64_t> miss_time(num_queries*QUERK_TOP_K);
+    std::vector<uint64_t> miss_observables(num_queries*QUERK_TOP_K);
+    std::vector<uint8_t> from_cache(num_queries);
+    std::vector<uint32_t> golden_candidate_neighbor(num_queries*QUERK_TOP_K);
+    std::vector<uint64_t> golden_candidate_time(num_queries*QUERK_TOP_K);
+    std::vector<uint64_t> golden_candidate_observables(num_queries*QUERK_TOP_K);
+    // candidates of the previous round, to answer from after a patch
+    std::vector<uint32_t> previous_neighbor;
+    std::vector<uint64_t> previous_time;
+    std::vector<uint32_t> changed_slots;
+    std::vector<uint32_t> golden_neighbor(num_queries);
+    std::vector<uint64_t> golden_time(num_queries);
+    std::vector<uint64_t> golden_observables(num_queries);
+    std::vector<uint32_t> engine_neighbor(num_queries);
+    std::vector<uint64_t> engine_time(num_queries);
+    engine_isa isa = engine_detect();
+    uint32_t max_weight = max_edge_weight(num_edges, neighbor_weights.data());
+
+    // The query batch is cut into several slices per worker so that a worker
+    // that falls behind leaves slices for the others to steal
+    uint32_t batch_size = std::max(1u, (num_queries + num_workers*SLICES_PER_WORKER - 1) / (num_workers*SLICES_PER_WORKER));
+
+    // Dynamic arrays are only ever written through the tracker, which keeps
+    // the list of entries the device has not seen yet
+    state_patches patches(radius.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), num_nodes, num_regions);
+    // With the packed layout the tracker also keeps one record per node, and
+    // the CPU backends query those and the edge records instead of the arrays
+    std::vector<node_state> node_states;
+    if (packed) {
+        node_states.resize(num_nodes);
+        patches.attach_node_states(node_states.data());
+    }
+    // Results of earlier rounds, dropped by the tracker for every node whose
+    // neighborhood a patch touched; only the queries it misses reach the device
+    event_cache cache(num_nodes, neighbor_offsets.data(), neighbors.data(), QUERK_TOP_K);
+    patches.attach_cache(&cache);
+    // The earliest event over the graph, kept current from the patched
+    // regions and nodes through the tracker's region-to-node index
+    event_frontier frontier(num_nodes, neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(),
+        region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data());
+    next_event earliest = frontier.recompute_all(64);
+    std::vector<uint32_t> region_frontier;
+
+    backend * device = NULL;
+    if (use_cpu) {
+        cpu_backend_mode mode = backend_kind == "golden" ? CPU_GOLDEN : backend_kind == "kernel" ? CPU_KERNEL :
+            backend_kind == "stream" ? CPU_STREAM : CPU_ENGINE;
+        device = make_cpu_backend(mode, num_workers);
+    } else {
+#ifdef QUERK_CPU_ONLY
+        printf("Error: built without OpenCL, use cpu, golden, kernel or stream instead of %s\n", binaryFile.c_str());
+#else
+        device = make_opencl_backend(binaryFile, num_workers);
+#endif
+    }
+    if (device == NULL) {
+        printf("Test failed\n");
+        exit(1);
+    }
+    printf("Backend %s with %u workers, %s layout\n", device->name(), device->num_workers(), packed ? "packed" : "split");
+
+    backend_graph graph;
+    graph.num_nodes = num_nodes;
+    graph.num_regions = num_regions;
+    graph.num_edges = num_edges;
+    graph.neighbor_offsets = neighbor_offsets.data();
+    graph.neighbors = neighbors.data();
+    graph.neighbor_weights = neighbor_weights.data();
+    graph.neighbor_observables = neighbor_observables.data();
+    graph.edges = edges.data();
+    graph.radius = radius.data();
+    graph.region_that_arrived_top = region_that_arrived_top.data();
+    graph.wrapped_radius_cached = wrapped_radius_cached.data();
+    graph.node_states = packed ? node_states.data() : NULL;
+    if (!device->upload_graph(graph, batch_size)) {
+        printf("Test failed\n");
+        exit(1);
+    }
 
+    // Each worker keeps up to pipeline_depth() batches in flight, so the upload
+    // of its next batch overlaps the run and readback of the ones before.
+    // Batches are cut from the cache misses, not from every query
+    auto run_batch = [&](uint32_t worker, const query_batch & batch) {
+        if (!device->submit_async(worker, batch.num_queries, miss_nodes.data() + batch.first,
+                miss_neighbor.data() + batch.first*QUERK_TOP_K, miss_time.data() + batch.first*QUERK_TOP_K, miss_observables.data() + batch.first*QUERK_TOP_K,
+                batch_callback())) {
+            printf("Test failed\n");
+            exit(1);
+        }
+    };
+    auto drain_workers = [&]() {
+        for (uint32_t w = 0; w < num_workers; w++) {
+            if (!device->drain(w)) {
+                printf("Test failed\n");
+                exit(1);
+            }
+        }
+    };
+    dispatcher workers(num_workers, run_batch);
 
+    bool test_result = true;
 
-	commands.finish();
+    for (int round = 0; round < NUM_ROUNDS; round++) {
 
-    // Write our data set into device buffers  
-     
-    err = commands.enqueueMigrateMemObjects({num_neighbors_buffer, radius_buffer, region_that_arrived_top_buffer, wrapped_radius_cached_buffer, neighbors_buffer, neighbor_weights_buffer, neighbor_observables_buffer, out_neighbor_buffer, out_time_buffer}, 0);
+        uint32_t patched_region = round % num_regions;
+        uint32_t patched_node = order.to_internal[round % num_nodes];
+        if (round > 0) {
+            // Between queries a decoder only grows a region and touches a node or two
+            patches.set_radius(patched_region, radius[patched_region] + 4);
+            patches.set_wrapped_radius_cached(patched_node, wrapped_radius_cached[patched_node] + 1);
+            earliest = frontier.update(patches.region_nodes, &patched_region, 1, &patched_node, 1, time_bits_for(max_weight, patches.local_radius_bound()));
+        }
 
-    if (err != CL_SUCCESS) {
-            printf("Error: Failed to write to device memory!\n");
+        uint32_t num_patches = patches.size();
+        if (!device->update_state(patches)) {
             printf("Test failed\n");
             exit(1);
-    }
+        }
+        patches.clear();
+
+        std::fill(out_neighbor.begin(), out_neighbor.end(), (uint32_t) -1);
+        std::fill(out_time.begin(), out_time.end(), (uint64_t) -1);
+        std::fill(out_observables.begin(), out_observables.end(), (uint64_t) -1);
+        workers.clear_stats();
+
+        cache.clear_stats();
+
+        std::chrono::high_resolution_clock::time_point start = NOW;
+
+        // Answer what the cache still holds and send the rest to the device
+        uint32_t num_misses = 0;
+        for (uint32_t q = 0; q < num_queries; q++) {
+            uint32_t first = q*QUERK_TOP_K;
+            from_cache[q] = cache.lookup(detector_nodes[q], &out_neighbor[first], &out_time[first], &out_observables[first]);
+            if (!from_cache[q]) {
+                miss_nodes[num_misses] = detector_nodes[q];
+                miss_queries[num_misses] = q;
+                num_misses++;
+            }
+        }
 
-	commands.finish();
-    
-    // Set the arguments to our compute kernel
-    OCL_CHECK(err, err = krnl.setArg(0, detector_node));
-    OCL_CHECK(err, err = krnl.setArg(1, num_nodes));
-    OCL_CHECK(err, err = krnl.setArg(2, num_regions));
-    OCL_CHECK(err, err = krnl.setArg(3, num_neighbors_buffer));
-    OCL_CHECK(err, err = krnl.setArg(4, radius_buffer));
-    OCL_CHECK(err, err = krnl.setArg(5, region_that_arrived_top_buffer));
-    OCL_CHECK(err, err = krnl.setArg(6, wrapped_radius_cached_buffer));
-    OCL_CHECK(err, err = krnl.setArg(7, neighbors_buffer));
-    OCL_CHECK(err, err = krnl.setArg(8, neighbor_weights_buffer));
-    OCL_CHECK(err, err = krnl.setArg(9, neighbor_observables_buffer));
-    OCL_CHECK(err, err = krnl.setArg(10, out_neighbor_buffer));
-    OCL_CHECK(err, err = krnl.setArg(11, out_time_buffer));
-
-    if (err != CL_SUCCESS) {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
-        printf("Test failed\n");
-        exit(1);
-    }
-    
+        if (num_misses > 0) {
+            workers.submit_range(num_misses, batch_size);
+            workers.wait();
+            drain_workers();
+        }
 
-	commands.finish();
+        for (uint32_t m = 0; m < num_misses; m++) {
+            uint32_t first = miss_queries[m]*QUERK_TOP_K;
+            std::copy(miss_neighbor.begin() + m*QUERK_TOP_K, miss_neighbor.begin() + (m + 1)*QUERK_TOP_K, out_neighbor.begin() + first);
+            std::copy(miss_time.begin() + m*QUERK_TOP_K, miss_time.begin() + (m + 1)*QUERK_TOP_K, out_time.begin() + first);
+            std::copy(miss_observables.begin() + m*QUERK_TOP_K, miss_observables.begin() + (m + 1)*QUERK_TOP_K, out_observables.begin() + first);
+            cache.store(miss_nodes[m], &miss_neighbor[m*QUERK_TOP_K], &miss_time[m*QUERK_TOP_K], &miss_observables[m*QUERK_TOP_K]);
+        }
 
-    std::chrono::high_resolution_clock::time_point start = NOW;
-    
-    // Execute the kernel over the entire range of our 1d input data set
-    // using the maximum number of work group items for this device
-    
-    err = commands.enqueueTask(krnl);
+        std::chrono::high_resolution_clock::time_point end = NOW;
+    	std::chrono::duration<double> time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
 
+        printf("Round %d: %u patches\n", round, num_patches);
+        printf("%s results (query 0): %d %ld\n", device->name(), (int) out_neighbor[0], (long int) out_time[0] );
+    	printf("%s time: %lf s for %u queries on %u workers (%lf queries/s)\n", device->name(), time.count(), num_queries, num_workers, num_queries / time.count());
+        printf("Event cache: %lu hits, %lu misses sent to %s\n", (unsigned long) cache.hits, (unsigned long) cache.misses, device->name());
+        for (uint32_t w = 0; w < num_workers; w++) {
+            printf("  worker %u: %lu batches (%lu stolen), %lu queries\n", w, (unsigned long) workers.stats[w].num_batches,
+                (unsigned long) workers.stats[w].num_stolen, (unsigned long) workers.stats[w].num_queries);
+        }
 
-    if (err) {
-        printf("Error: Failed to execute kernel! %d\n", err);
-        printf("Test failed\n");
-        exit(1);
-    }
+    	//Checking the results 
 
-    commands.finish();
-    std::chrono::high_resolution_clock::time_point end = NOW;
-	std::chrono::duration<double> time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
-    
-    // Read back the results from the device to verify the output
-  
-    err = commands.enqueueMigrateMemObjects({out_neighbor_buffer, out_time_buffer}, CL_MIGRATE_MEM_OBJECT_HOST);  
-    commands.finish();
-    printf("Hardware results: %d %ld\n", (int) out_neighbor[0], (long int) out_time[0] );
-
-    if (err != CL_SUCCESS) {
-        printf("Error: Failed to read output array! %d\n", err);
-        printf("Test failed\n");
-        exit(1);
-    }
+        start = NOW;
 
-	//printf("HW time: %lf\n", time);
+        find_next_event_at_nodes_returning_neighbor_index_and_time(num_queries, detector_nodes.data(), neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data(), golden_neighbor.data(), golden_time.data());
+        find_next_event_observables(num_queries, detector_nodes.data(), neighbor_offsets.data(), neighbor_observables.data(), golden_neighbor.data(), golden_observables.data());
 
-	//Checking the results 
+    	end = NOW;
+    	time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
 
+        std::cout << "Golden results (query 0): " <<  golden_neighbor[0] << " " << golden_time[0] << std::endl;
 
-    start = NOW;
+    	printf("SW time: %lf s for %u queries (%lf queries/s)\n", time.count(), num_queries, num_queries / time.count());
 
-    auto golden = find_next_event_at_node_returning_neighbor_index_and_time(detector_node, num_neighbors.data(), (uint32_t (*) [NUM_NEIGHBORS]) neighbors.data(), (uint32_t (*) [NUM_NEIGHBORS]) neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data());
-	
+        // the narrowest datapath that is exact for this round's radii
+        uint32_t time_bits = time_bits_for(max_weight, patches.local_radius_bound());
 
+        start = NOW;
 
-    // for(unsigned i = 0 ; i < num; i++){
-	// 	// Allocate MM
-	// 	mm_allocator_t* const mm_allocator = mm_allocator_new(BUFFER_SIZE_8M);
-	// 	// Init Affine-WFA
-	// 	affine_wavefronts_t* affine_wavefronts = affine_wavefronts_new_complete(
-	// 		pattern_test[i].size(), text_test[i].length(), &affine_penalties, NULL, mm_allocator);
-	// 	// Align
-	// 	affine_wavefronts_align(affine_wavefronts, pattern_test[i].c_str(), pattern_test[i].length(),
-	// 		text_test[i].c_str(), text_test[i].length(), &sw_scores[i]);
+        if (packed) {
+            engine_find_next_events_packed(isa, time_bits, num_queries, detector_nodes.data(), neighbor_offsets.data(), edges.data(), node_states.data(), engine_neighbor.data(), engine_time.data());
+        } else {
+            engine_find_next_events(isa, time_bits, num_queries, detector_nodes.data(), neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data(), engine_neighbor.data(), engine_time.data());
+        }
 
-	// 	affine_wavefronts_delete(affine_wavefronts);
-	// 	mm_allocator_delete(mm_allocator);
+    	end = NOW;
+    	time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
 
-	// }
+    	printf("SW %s/%u time: %lf s for %u queries (%lf queries/s)\n", engine_isa_name(isa), time_bits, time.count(), num_queries, num_queries / time.count());
 
-	end = NOW;
-	time = std::chrono::duration_cast<std::chrono::duration<double>>(end-start);
+        for (uint32_t q = 0; q < num_queries; q++) {
+            uint32_t first = q*QUERK_TOP_K;
+            const char * source = from_cache[q] ? "cache" : device->name();
+            if (out_neighbor[first] != golden_neighbor[q] || out_time[first] != golden_time[q]) {
+                printf("Query %u (detector %u) %s: %d %ld, SW: %d %ld\n", q, order.to_original[detector_nodes[q]], source, (int) out_neighbor[first], (long int) out_time[first], (int) golden_neighbor[q], (long int) golden_time[q]);
+                test_result = false;
+            }
+            if (out_observables[first] != golden_observables[q]) {
+                printf("Query %u (detector %u) %s: observables %lx, SW: %lx\n", q, order.to_original[detector_nodes[q]], source, (unsigned long) out_observables[first], (unsigned long) golden_observables[q]);
+                test_result = false;
+            }
+            if (engine_neighbor[q] != golden_neighbor[q] || engine_time[q] != golden_time[q]) {
+                printf("Query %u (detector %u) %s: %d %ld, SW: %d %ld\n", q, order.to_original[detector_nodes[q]], engine_isa_name(isa), (int) engine_neighbor[q], (long int) engine_time[q], (int) golden_neighbor[q], (long int) golden_time[q]);
+                test_result = false;
+            }
+        }
 
-    std::cout << "Golden results: " <<  golden.first << " " << golden.second << std::endl;
+        // The remaining candidates, against the golden lists
+        if (QUERK_TOP_K > 1) {
+            find_next_events_top_k(QUERK_TOP_K, num_queries, detector_nodes.data(), neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data(), golden_candidate_neighbor.data(), golden_candidate_time.data());
+            find_next_event_observables(num_queries, detector_nodes.data(), neighbor_offsets.data(), neighbor_observables.data(), golden_candidate_neighbor.data(), golden_candidate_observables.data(), QUERK_TOP_K);
+            for (uint32_t i = 0; i < num_queries*QUERK_TOP_K; i++) {
+                if (out_neighbor[i] != golden_candidate_neighbor[i] || out_time[i] != golden_candidate_time[i] || out_observables[i] != golden_candidate_observables[i]) {
+                    uint32_t q = i / QUERK_TOP_K;
+                    printf("Query %u (detector %u) candidate %u %s: %d %ld %lx, SW: %d %ld %lx\n", q, order.to_original[detector_nodes[q]], i % QUERK_TOP_K, from_cache[q] ? "cache" : device->name(),
+                        (int) out_neighbor[i], (long int) out_time[i], (unsigned long) out_observables[i],
+                        (int) golden_candidate_neighbor[i], (long int) golden_candidate_time[i], (unsigned long) golden_candidate_observables[i]);
+                    test_result = false;
+                }
+            }
+        }
 
-	//printf("SW time: %lf\n", time);
+        // Answer the nodes next to this round's patch from last round's
+        // candidates: a node whose own record is untouched only sees its edges
+        // to the patched node and into the patched region change
+        if (round > 0) {
+            uint32_t num_affected = 0;
+            uint32_t num_resolved = 0;
+            for (uint32_t q = 0; q < std::min(num_queries, num_nodes); q++) {
+                uint32_t n = detector_nodes[q];
+                if (n == patched_node || region_that_arrived_top[n] == patched_region) {
+                    continue;
+                }
+                changed_slots.clear();
+                for (uint32_t e = neighbor_offsets[n]; e < neighbor_offsets[n + 1]; e++) {
+                    uint32_t other = neighbors[e];
+                    if (other != (uint32_t) -1 && (other == patched_node || region_that_arrived_top[other] == patched_region)) {
+                        changed_slots.push_back(e - neighbor_offsets[n]);
+                    }
+                }
+                if (changed_slots.empty()) {
+                    continue;
+                }
+                num_affected++;
+                uint32_t neighbor;
+                uint64_t time;
+                if (!next_event_from_candidates(QUERK_TOP_K, previous_neighbor.data() + q*QUERK_TOP_K, previous_time.data() + q*QUERK_TOP_K,
+                        changed_slots.size(), changed_slots.data(), n, neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(),
+                        region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data(), neighbor, time)) {
+                    continue;
+                }
+                num_resolved++;
+                if (neighbor != golden_neighbor[q] || time != golden_time[q]) {
+                    printf("Query %u (detector %u) candidates: %d %ld, SW: %d %ld\n", q, order.to_original[n], (int) neighbor, (long int) time, (int) golden_neighbor[q], (long int) golden_time[q]);
+                    test_result = false;
+                }
+            }
+            printf("Candidates: %u of %u nodes next to the patch resolved without a query\n", num_resolved, num_affected);
+        }
+        previous_neighbor = out_neighbor;
+        previous_time = out_time;
+
+        // The incremental minimum must match a scan of every node
+        next_event scanned = {(uint32_t) -1, (uint32_t) -1, (uint64_t) MAX};
+        for (uint32_t n = 0; n < num_nodes; n++) {
+            auto event = find_next_event_at_node_returning_neighbor_index_and_time(n, neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data());
+            if (event.second < scanned.time) {
+                scanned = {n, (uint32_t) event.first, event.second};
+            }
+        }
+        printf("Next event: node %d at %ld, %lu of %u nodes recomputed\n", (int) earliest.node, (long int) earliest.time, (unsigned long) frontier.num_recomputed, num_nodes);
+        if (earliest.node != scanned.node || earliest.neighbor != scanned.neighbor || earliest.time != scanned.time) {
+            printf("Frontier: node %d %d %ld, scan: node %d %d %ld\n", (int) earliest.node, (int) earliest.neighbor, (long int) earliest.time, (int) scanned.node, (int) scanned.neighbor, (long int) scanned.time);
+            test_result = false;
+        }
 
+        // Region-scope query: one reduced result per batch of the region's
+        // frontier instead of one per node, checked against the per-node golden
+        uint32_t region = round % num_regions;
+        patches.region_frontier(region, neighbor_offsets.data(), neighbors.data(), region_frontier);
+        batch_minimum region_min = {(uint32_t) -1, (uint32_t) -1, (uint64_t) MAX, 0};
+        for (uint32_t first = 0; first < region_frontier.size(); first += batch_size) {
+            uint32_t n = std::min(batch_size, (uint32_t) region_frontier.size() - first);
+            batch_minimum m;
+            if (!device->query_min(0, n, region_frontier.data() + first, m)) {
+                printf("Test failed\n");
+                exit(1);
+            }
+            if (m.time < region_min.time) {
+                region_min = m;
+                region_min.query += first;
+            }
+        }
+        batch_minimum region_golden = {(uint32_t) -1, (uint32_t) -1, (uint64_t) MAX, 0};
+        for (uint32_t q = 0; q < region_frontier.size(); q++) {
+            uint32_t n = region_frontier[q];
+            auto event = find_next_event_at_node_returning_neighbor_index_and_time(n, neighbor_offsets.data(), neighbors.data(), neighbor_weights.data(), region_that_arrived_top.data(), wrapped_radius_cached.data(), radius.data());
+            if (event.second < region_golden.time) {
+                uint64_t observables = neighbor_observables[neighbor_offsets[n] + event.first];
+                region_golden = {q, (uint32_t) event.first, event.second, observables};
+            }
+        }
+        printf("Region %u: %lu frontier nodes, next event at %ld\n", region, (unsigned long) region_frontier.size(), (long int) region_min.time);
+        if (region_min.query != region_golden.query || region_min.neighbor != region_golden.neighbor ||
+            region_min.time != region_golden.time || region_min.observables != region_golden.observables) {
+            printf("Region %u %s: %d %d %ld %lx, SW: %d %d %ld %lx\n", region, device->name(), (int) region_min.query, (int) region_min.neighbor, (long int) region_min.time, (unsigned long) region_min.observables,
+                (int) region_golden.query, (int) region_golden.neighbor, (long int) region_golden.time, (unsigned long) region_golden.observables);
+            test_result = false;
+        }
+    }
 
-	// for (int i=0; i<num; i++){
-	// 	if (scores[i]!=sw_scores[i]){
-    //         printf("HW: %d, SW: %d\n", scores[i], sw_scores[i]);
-    //         test_score=false;
-    //     }
-	// }
+    delete device;
 
-	// if (test_score) 
-	// 	std::cout<<"All scores correct"<<std::endl;
-	// else 
-	// 	std::cout<<"Test failed"<<std::endl;
+    if (test_result)
+        std::cout<<"All results correct"<<std::endl;
+    else
+        std::cout<<"Test failed"<<std::endl;
 
 }
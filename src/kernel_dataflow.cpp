@@ -6,64 +6,139 @@
 #include "ap_int.h"
 #include "kernel_simple.h"
 const int fifo_in_depth = 100;
+const int max_batch_size = 1024;
+const int max_patches = MAX_PATCHES;
+const int max_cached_nodes = MAX_CACHED_NODES;
+const int max_cached_edges = MAX_CACHED_EDGES;
+
+// Radius words and collision times inside the kernel are QUERK_TIME_BITS wide
+// (querk_params.h): the rad and time FIFOs and the arithmetic between them.
+// They are computed modulo 2^QUERK_TIME_BITS and widened to 64 bits on the
+// way out, see widen_time in next_event.h.
+typedef ap_uint<QUERK_TIME_BITS> querk_time;
+#define TIME_NONE ((((ap_uint<64>) 1) << (QUERK_TIME_BITS - 1)) - 1)
+
+// Neighbors cross the compute stages QUERK_NEIGHBOR_LANES edge slots at a time
+// (querk_params.h), one FIFO word per group with a field per lane.
+const int max_neighbor_groups = (fifo_in_depth + QUERK_NEIGHBOR_LANES - 1) / QUERK_NEIGHBOR_LANES;
+typedef ap_uint<32*QUERK_NEIGHBOR_LANES> neighbor_words;
+typedef ap_uint<64*QUERK_NEIGHBOR_LANES> neighbor_observables;
+typedef ap_uint<QUERK_TIME_BITS*QUERK_NEIGHBOR_LANES> neighbor_times;
+typedef ap_uint<QUERK_NEIGHBOR_LANES> neighbor_flags;
+
+// Each query leaves compute_collision with its QUERK_TOP_K earliest candidates
+// (querk_params.h), one result FIFO word with a field per candidate, and takes
+// QUERK_TOP_K entries of every output array.
+const int max_results = max_batch_size * QUERK_TOP_K;
+typedef ap_uint<32*QUERK_TOP_K> candidate_words;
+typedef ap_uint<64*QUERK_TOP_K> candidate_observables;
+typedef ap_uint<QUERK_TIME_BITS*QUERK_TOP_K> candidate_times;
+
+template <int W>
+ap_uint<64> widen_time(ap_uint<W> time){
+    #pragma HLS INLINE
+    ap_uint<64> wide = time;
+    if(time[W-1]){
+        // negative: sign-extended
+        wide = wide - (((ap_uint<64>) 1) << W);
+    }else if(time[W-2]){
+        // negative time of two growing regions, halved: just below 2^63
+        wide = wide + (((ap_uint<64>) 1) << 63) - (((ap_uint<64>) 1) << (W-1));
+    }
+    return wide;
+}
 
-#define NUM_NODES 100
-#define NUM_REGIONS 10
-#define NUM_NEIGHBORS 2
-#define MAX 9223372036854775807
+template <>
+ap_uint<64> widen_time<64>(ap_uint<64> time){
+    return time;
+}
 
-void init_data(
-    hls::stream<ap_uint<64> >& rad1,
-    hls::stream<ap_uint<64> >& rad1_2,
+// On-chip copy of the static graph. Static, so it outlives the call that
+// loaded it: one GRAPH_LOAD, then any number of GRAPH_CACHED calls.
+static ap_uint<32> cached_offsets[MAX_CACHED_NODES + 1];
+static ap_uint<128> cached_edges[MAX_CACHED_EDGES];
+// querk_stream only: its packed node records, kept current by the patch
+// commands on its input stream
+static ap_uint<128> stream_node_states[MAX_CACHED_NODES];
+
+// Pushes everything the two compute stages need to answer one query
+template <int P>
+void fetch_query(
+    hls::stream<querk_time>& rad1,
+    hls::stream<querk_time>& rad1_2,
     hls::stream<ap_uint<32> >& rtat,
     hls::stream<ap_uint<32> >& nn,
     hls::stream<ap_uint<32> >& nn_2,
     hls::stream<ap_uint<32> >& best_neighbor,
-    hls::stream<ap_uint<64> >& collision_time,
-    hls::stream<ap_uint<64> >& best_time,
+    hls::stream<ap_uint<64> >& best_observables,
+    hls::stream<querk_time>& collision_time,
+    hls::stream<querk_time>& best_time,
     hls::stream<ap_uint<32> >& start_1,
     hls::stream<ap_uint<32> >& start_2,
-    hls::stream<ap_uint<32> >& neighbor_weights_stream,
-    hls::stream<ap_uint<32> >& wrapped_radius_cached_stream,
-    hls::stream<ap_uint<32> >& region_that_arrived_top_stream,
-    hls::stream<ap_uint<64> >& radius_stream,
+    hls::stream<ap_uint<32*P> >& neighbor_weights_stream,
+    hls::stream<ap_uint<64*P> >& neighbor_observables_stream,
+    hls::stream<ap_uint<32*P> >& wrapped_radius_cached_stream,
+    hls::stream<ap_uint<32*P> >& region_that_arrived_top_stream,
+    hls::stream<ap_uint<QUERK_TIME_BITS*P> >& radius_stream,
     ap_uint<32> * region_that_arrived_top,
-    ap_uint<32> * num_neighbors,
+    ap_uint<32> * neighbor_offsets,
     ap_uint<32> * wrapped_radius_cached,
     ap_uint<64> * radius,
-    ap_uint<32> neighbors[][NUM_NEIGHBORS],
-    ap_uint<32> neighbor_weights[][NUM_NEIGHBORS],
-    ap_uint<32> detector_node
-
-
-
+    ap_uint<128> * edges,
+    ap_uint<32> detector_node,
+    ap_uint<128> * node_states,
+    ap_uint<32> packed_node_states,
+    bool cached_graph
     ){
-
-
-        ap_uint<32> rtat_tmp = region_that_arrived_top[detector_node];
+        #pragma HLS INLINE
+
+        ap_uint<32> rtat_tmp;
+        querk_time rad1_tmp;
+        if(packed_node_states){
+            // one record holds both the region and the resolved local radius
+            ap_uint<128> record = node_states[detector_node];
+            rtat_tmp = record.range(95,64);
+            rad1_tmp = record.range(63,0);
+        }else{
+            rtat_tmp = region_that_arrived_top[detector_node];
+            if(rtat_tmp == -1){
+                rad1_tmp = 0;
+            }else{
+                rad1_tmp = radius[rtat_tmp] + (wrapped_radius_cached[detector_node] << 2);
+            }
+        }
         rtat << rtat_tmp;
-        ap_uint<32> nn_tmp = num_neighbors[detector_node];
+        rad1 << rad1_tmp;
+        rad1_2 << rad1_tmp;
+        // CSR: the node's edges are [first, first + nn_tmp)
+        ap_uint<32> first;
+        ap_uint<32> last;
+        if(cached_graph){
+            first = cached_offsets[detector_node];
+            last = cached_offsets[detector_node + 1];
+        }else{
+            first = neighbor_offsets[detector_node];
+            last = neighbor_offsets[detector_node + 1];
+        }
+        ap_uint<32> nn_tmp = last - first;
         nn << nn_tmp;
         nn_2 << nn_tmp;
-        ap_uint<64> rad1_tmp;
         ap_uint<32> start_tmp = 0;
 
         ap_uint<32> best_neighbor_tmp = MAX;
-        ap_uint<64> best_time_tmp = MAX;
-        ap_uint<64> collision_time_tmp;
+        ap_uint<64> best_observables_tmp = 0;
+        querk_time best_time_tmp = TIME_NONE;
+        querk_time collision_time_tmp;
 
 
-        if(rtat_tmp == -1){
-            rad1_tmp =0;
-            rad1 << rad1_tmp;
-            rad1_2 << rad1_tmp;
-        }else{
-            rad1_tmp = radius[rtat_tmp] + (wrapped_radius_cached[detector_node] << 2);
-            rad1 << rad1_tmp;
-            rad1_2 << rad1_tmp;
+        // the boundary edge, if any, is the first record of the node
+        ap_uint<128> first_edge = 0;
+        if(!(nn_tmp==0)){
+            first_edge = cached_graph ? cached_edges[first] : edges[first];
         }
+        ap_uint<32> first_neighbor = first_edge.range(31,0);
 
-        if(!(nn_tmp==0) && neighbors[detector_node][0] == -1){
+        if(!(nn_tmp==0) && first_neighbor == -1){
             start_tmp=1;
             
         }
@@ -71,162 +146,435 @@ void init_data(
         start_1 << start_tmp;
         start_2 << start_tmp;
 
-        if((rad1_tmp &1) && !(nn_tmp==0) && neighbors[detector_node][0] == -1){
-            ap_uint<32> weight = neighbor_weights[detector_node][0];
+        if((rad1_tmp &1) && !(nn_tmp==0) && first_neighbor == -1){
+            ap_uint<32> weight = first_edge.range(63,32);
             collision_time_tmp = weight - ( (rad1_tmp >> 2) << 2);
 
             if(collision_time_tmp < best_time_tmp){
                 best_time_tmp = collision_time_tmp;
                 best_neighbor_tmp = 0;
+                best_observables_tmp = first_edge.range(127,64);
             }
 
         }
         best_time << best_time_tmp;
         best_neighbor << best_neighbor_tmp;
+        best_observables << best_observables_tmp;
         collision_time << collision_time_tmp;
 
-        for(int i=start_tmp;i<nn_tmp;i++){
-
-        #pragma HLS LOOP_TRIPCOUNT min =0 max = fifo_in_depth
-            neighbor_weights_stream << neighbor_weights[detector_node][i];
-            ap_uint<32> tmp=neighbors[detector_node][i];
+        // P edge slots per group; the slots past the last edge are padding
+        // that compute_radius_and_valid marks invalid
+        ap_uint<32> num_groups = (nn_tmp - start_tmp + P - 1) / P;
+        for(unsigned int g=0;g<num_groups;g++){
+            #pragma HLS LOOP_TRIPCOUNT min =0 max = max_neighbor_groups
+            ap_uint<32*P> weights;
+            ap_uint<64*P> observables;
+            ap_uint<32*P> regions;
+            ap_uint<32*P> wrapped;
+            ap_uint<QUERK_TIME_BITS*P> radii;
+
+            for(int l=0;l<P;l++){
+                #pragma HLS UNROLL
+                ap_uint<32> i = start_tmp + g*P + l;
+                ap_uint<32> weight = 0;
+                ap_uint<64> edge_observables = 0;
+                ap_uint<32> rtatn = -1;
+                ap_uint<32> wrcn = 0;
+                querk_time radn = 0;
+
+                if(i < nn_tmp){
+                    // neighbor, weight and observables arrive in one burst
+                    ap_uint<128> edge = cached_graph ? cached_edges[first + i] : edges[first + i];
+                    weight = edge.range(63,32);
+                    edge_observables = edge.range(127,64);
+                    ap_uint<32> tmp=edge.range(31,0);
+
+                    if(packed_node_states){
+                        // the record radius is already local, so no wrapped part is added
+                        ap_uint<128> record = node_states[tmp];
+                        rtatn = record.range(95,64);
+                        radn = record.range(63,0);
+                    }else{
+                        rtatn = region_that_arrived_top[tmp];
+                        wrcn = wrapped_radius_cached[tmp];
+                        if(!(rtatn == -1)){
+                            radn = radius[rtatn];
+                        }
+                    }
+                }
 
-            region_that_arrived_top_stream << region_that_arrived_top[tmp];
+                weights.range(32*l+31,32*l) = weight;
+                observables.range(64*l+63,64*l) = edge_observables;
+                regions.range(32*l+31,32*l) = rtatn;
+                wrapped.range(32*l+31,32*l) = wrcn;
+                radii.range(QUERK_TIME_BITS*l+QUERK_TIME_BITS-1,QUERK_TIME_BITS*l) = radn;
+            }
 
-            wrapped_radius_cached_stream << wrapped_radius_cached[tmp];
+            neighbor_weights_stream << weights;
+            neighbor_observables_stream << observables;
+            region_that_arrived_top_stream << regions;
+            wrapped_radius_cached_stream << wrapped;
+            radius_stream << radii;
+        }
+}
 
-            radius_stream << radius[region_that_arrived_top[tmp]];
+template <int P>
+void init_data(
+    hls::stream<querk_time>& rad1,
+    hls::stream<querk_time>& rad1_2,
+    hls::stream<ap_uint<32> >& rtat,
+    hls::stream<ap_uint<32> >& nn,
+    hls::stream<ap_uint<32> >& nn_2,
+    hls::stream<ap_uint<32> >& best_neighbor,
+    hls::stream<ap_uint<64> >& best_observables,
+    hls::stream<querk_time>& collision_time,
+    hls::stream<querk_time>& best_time,
+    hls::stream<ap_uint<32> >& start_1,
+    hls::stream<ap_uint<32> >& start_2,
+    hls::stream<ap_uint<32*P> >& neighbor_weights_stream,
+    hls::stream<ap_uint<64*P> >& neighbor_observables_stream,
+    hls::stream<ap_uint<32*P> >& wrapped_radius_cached_stream,
+    hls::stream<ap_uint<32*P> >& region_that_arrived_top_stream,
+    hls::stream<ap_uint<QUERK_TIME_BITS*P> >& radius_stream,
+    ap_uint<32> * region_that_arrived_top,
+    ap_uint<32> * neighbor_offsets,
+    ap_uint<32> * wrapped_radius_cached,
+    ap_uint<64> * radius,
+    ap_uint<128> * edges,
+    ap_uint<32> num_queries,
+    ap_uint<32> * detector_nodes,
+    ap_uint<128> * node_states,
+    ap_uint<32> packed_node_states,
+    bool cached_graph
+    ){
 
-        }
+    for(unsigned int q=0;q<num_queries;q++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_batch_size
 
+        fetch_query<P>(rad1, rad1_2, rtat, nn, nn_2, best_neighbor, best_observables, collision_time, best_time, start_1, start_2,
+            neighbor_weights_stream, neighbor_observables_stream, wrapped_radius_cached_stream, region_that_arrived_top_stream, radius_stream,
+            region_that_arrived_top, neighbor_offsets, wrapped_radius_cached, radius, edges,
+            detector_nodes[q], node_states, packed_node_states, cached_graph);
     }
+}
 
+template <int P>
 void compute_radius_and_valid(hls::stream<ap_uint<32> >& start_1,
-            hls::stream<bool> &valid_stream,
-            hls::stream<ap_uint<64> > &rad2_stream,
-            hls::stream<ap_uint<32> >& region_that_arrived_top_stream,
-            hls::stream<ap_uint<32> > &wrapped_radius_cached_stream,
-            hls::stream<ap_uint<64> > &radius_stream,
-            hls::stream<ap_uint<64> >& rad1,
+            hls::stream<ap_uint<P> > &valid_stream,
+            hls::stream<ap_uint<QUERK_TIME_BITS*P> > &rad2_stream,
+            hls::stream<ap_uint<32*P> >& region_that_arrived_top_stream,
+            hls::stream<ap_uint<32*P> > &wrapped_radius_cached_stream,
+            hls::stream<ap_uint<QUERK_TIME_BITS*P> > &radius_stream,
+            hls::stream<querk_time>& rad1,
             hls::stream<ap_uint<32> >& rtat,
-            hls::stream<ap_uint<32> >& nn){
-    ap_uint<32> start_tmp = start_1.read();
-    ap_uint<64> rad1_tmp = rad1.read();
-    ap_uint<32> rtat_tmp = rtat.read();
-    ap_uint<32> nn_tmp = nn.read();
-
-
-
-    for(int i=start_tmp;i<nn_tmp;i++){
-        #pragma HLS LOOP_TRIPCOUNT min =0 max = fifo_in_depth
-        ap_uint<32> rtatn = region_that_arrived_top_stream.read();
+            hls::stream<ap_uint<32> >& nn,
+            ap_uint<32> num_queries){
+
+    for(unsigned int q=0;q<num_queries;q++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_batch_size
+        ap_uint<32> start_tmp = start_1.read();
+        querk_time rad1_tmp = rad1.read();
+        ap_uint<32> rtat_tmp = rtat.read();
+        ap_uint<32> nn_tmp = nn.read();
+
+        ap_uint<32> num_groups = (nn_tmp - start_tmp + P - 1) / P;
+        for(unsigned int g=0;g<num_groups;g++){
+            #pragma HLS LOOP_TRIPCOUNT min =0 max = max_neighbor_groups
+            #pragma HLS PIPELINE II=1
+            ap_uint<32*P> regions = region_that_arrived_top_stream.read();
+            ap_uint<QUERK_TIME_BITS*P> radii = radius_stream.read();
+            ap_uint<32*P> wrapped = wrapped_radius_cached_stream.read();
+            ap_uint<P> valid;
+            ap_uint<QUERK_TIME_BITS*P> rad2;
+
+            for(int l=0;l<P;l++){
+                #pragma HLS UNROLL
+                ap_uint<32> rtatn = regions.range(32*l+31,32*l);
+                querk_time radn = radii.range(QUERK_TIME_BITS*l+QUERK_TIME_BITS-1,QUERK_TIME_BITS*l);
+                ap_uint<32> wrcn = wrapped.range(32*l+31,32*l);
+
+                // a padding lane is never valid
+                ap_uint<32> i = start_tmp + g*P + l;
+                valid[l] = i < nn_tmp && !((rad1_tmp & 1) && rtat_tmp==rtatn);
+
+                querk_time rad2_tmp = 0;
+                if(!(rtatn == -1)){
+                    rad2_tmp = radn + (wrcn<<2);
+                }
+                rad2.range(QUERK_TIME_BITS*l+QUERK_TIME_BITS-1,QUERK_TIME_BITS*l) = rad2_tmp;
+            }
 
-        if((rad1_tmp & 1) && rtat_tmp==rtatn){
-            valid_stream << false;            
-        }else{
-            valid_stream << true;
+            valid_stream << valid;
+            rad2_stream << rad2;
         }
+    }
+}
 
-        if(rtatn == -1){
-            rad2_stream << 0;
-        }else{
-            rad2_stream << (radius_stream.read() + (wrapped_radius_cached_stream.read()<<2));
+// Collision time of one neighbor lane and whether it is an event at all: the
+// loop body of the sequential version, without the comparison to the best.
+void lane_collision(querk_time rad1_tmp, querk_time rad2, ap_uint<32> weight, bool valid,
+            querk_time & collision_time_tmp, bool & candidate){
+    #pragma HLS INLINE
+    candidate = false;
+    collision_time_tmp = weight - ((rad1_tmp >> 2) << 2) - ((rad2 >> 2) << 2);
+    if(valid && !((rad1_tmp & 1) && (rad2 & 2))){
+        if((rad1_tmp & 1)) {
+            if((rad2 & 1)){
+                collision_time_tmp >>= 1;
+            }
+            candidate = true;
         }
+        if (!(rad1_tmp & 1) && (rad2 & 1)) {
+            candidate = true;
+        }
+    }
+}
 
-
+// Pipelined tree argmin over the P lanes of a group, P a power of two: each
+// level halves the lanes, and of two equal times the lower lane wins, so the
+// result is the first minimum a sequential scan would keep. The winning edge's
+// observables travel with its lane.
+template <int P>
+void argmin_lanes(querk_time time[P], bool candidate[P], ap_uint<32> lane[P], ap_uint<64> observables[P]){
+    #pragma HLS INLINE
+    for(int width=P/2;width>=1;width/=2){
+        #pragma HLS UNROLL
+        for(int l=0;l<width;l++){
+            #pragma HLS UNROLL
+            bool take_right = candidate[2*l+1] && (!candidate[2*l] || time[2*l+1] < time[2*l]);
+            time[l] = take_right ? time[2*l+1] : time[2*l];
+            lane[l] = take_right ? lane[2*l+1] : lane[2*l];
+            observables[l] = take_right ? observables[2*l+1] : observables[2*l];
+            candidate[l] = candidate[2*l] || candidate[2*l+1];
+        }
     }
 }
 
+// Inserts one candidate into the sorted top list; a time equal to a listed
+// one goes after it, so ties stay in edge order as with the argmin. Every
+// slot compares against the new time and its upper neighbor at once.
+void insert_candidate(querk_time time, ap_uint<32> neighbor, ap_uint<64> observables,
+            querk_time top_time[QUERK_TOP_K], ap_uint<32> top_neighbor[QUERK_TOP_K], ap_uint<64> top_observables[QUERK_TOP_K]){
+    #pragma HLS INLINE
+    for(int j=QUERK_TOP_K-1;j>=0;j--){
+        #pragma HLS UNROLL
+        bool below = time < top_time[j];
+        bool below_upper = j > 0 && time < top_time[j > 0 ? j-1 : 0];
+        if(below_upper){
+            top_time[j] = top_time[j-1];
+            top_neighbor[j] = top_neighbor[j-1];
+            top_observables[j] = top_observables[j-1];
+        }else if(below){
+            top_time[j] = time;
+            top_neighbor[j] = neighbor;
+            top_observables[j] = observables;
+        }
+    }
+}
 
+// Evaluates the P lanes of a group in parallel and folds the group's argmin
+// into the best event so far. Groups are in edge order and a group only
+// replaces the best on a strictly smaller time, so ties still go to the
+// lowest neighbor index: O(degree/P + log P) per query instead of O(degree).
+// With QUERK_TOP_K above 1 the lanes are inserted one after the other into
+// the sorted list of the earliest candidates instead.
+template <int P>
 void compute_collision(hls::stream<ap_uint<32> >& start_2,
             hls::stream<ap_uint<32> >& best_neighbor,
-            hls::stream<ap_uint<64> >& best_time,
-            hls::stream<ap_uint<64> >& collision_time, 
-            hls::stream<ap_uint<64> >& rad_2_stream,
-            hls::stream<ap_uint<32> > &neighbor_weights_stream,
-            hls::stream<bool>& valid_stream,
-            hls::stream<ap_uint<64> >& rad1,
+            hls::stream<ap_uint<64> >& best_observables,
+            hls::stream<querk_time>& best_time,
+            hls::stream<querk_time>& collision_time,
+            hls::stream<ap_uint<QUERK_TIME_BITS*P> >& rad_2_stream,
+            hls::stream<ap_uint<32*P> > &neighbor_weights_stream,
+            hls::stream<ap_uint<64*P> > &neighbor_observables_stream,
+            hls::stream<ap_uint<P> >& valid_stream,
+            hls::stream<querk_time>& rad1,
             hls::stream<ap_uint<32> >& nn,
-            ap_uint<32> * out_neighbor, ap_uint<64> * out_time){
-
-    ap_uint<32> start_tmp = start_2.read();
-    ap_uint<64> rad1_tmp = rad1.read();
-    ap_uint<32> nn_tmp = nn.read();
-
-    ap_uint<32> best_neighbor_tmp = best_neighbor.read();
-    ap_uint<64> best_time_tmp = best_time.read();
-    ap_uint<64> collision_time_tmp = collision_time.read();
-
-
-
-    for(int i=start_tmp;i<nn_tmp;i++){
-        #pragma HLS LOOP_TRIPCOUNT min =0 max = fifo_in_depth
-        
-
-        ap_uint<64>  rad2 = rad_2_stream.read();
-        bool valid = valid_stream.read();
-
-        ap_uint<32> weight = neighbor_weights_stream.read();
-        if(valid && !((rad1_tmp & 1) && (rad2 & 2))){
-
-            if((rad1_tmp & 1)) {
-	            collision_time_tmp = weight - ((rad1_tmp >> 2) << 2) - ((rad2 >> 2) << 2);
-	        }
-	        if ((rad1_tmp & 1) && (rad2 & 1)) {
-	            collision_time_tmp >>= 1;
-	        }
-            if ((rad1_tmp & 1) && collision_time_tmp < best_time_tmp) {
-                    best_time_tmp = collision_time_tmp;
-                    best_neighbor_tmp = i;
+            ap_uint<32> num_queries,
+            hls::stream<candidate_words>& result_neighbor, hls::stream<candidate_observables>& result_observables, hls::stream<candidate_times>& result_time){
+
+    for(unsigned int q=0;q<num_queries;q++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_batch_size
+        ap_uint<32> start_tmp = start_2.read();
+        querk_time rad1_tmp = rad1.read();
+        ap_uint<32> nn_tmp = nn.read();
+
+        // the boundary edge of fetch_query is the first candidate
+        querk_time top_time[QUERK_TOP_K];
+        ap_uint<32> top_neighbor[QUERK_TOP_K];
+        ap_uint<64> top_observables[QUERK_TOP_K];
+        #pragma HLS ARRAY_PARTITION variable=top_time complete
+        #pragma HLS ARRAY_PARTITION variable=top_neighbor complete
+        #pragma HLS ARRAY_PARTITION variable=top_observables complete
+        for(int j=1;j<QUERK_TOP_K;j++){
+            #pragma HLS UNROLL
+            top_time[j] = TIME_NONE;
+            top_neighbor[j] = -1;
+            top_observables[j] = 0;
+        }
+        top_neighbor[0] = best_neighbor.read();
+        top_observables[0] = best_observables.read();
+        top_time[0] = best_time.read();
+        // only the boundary edge of fetch_query used it
+        collision_time.read();
+
+        ap_uint<32> num_groups = (nn_tmp - start_tmp + P - 1) / P;
+        for(unsigned int g=0;g<num_groups;g++){
+            #pragma HLS LOOP_TRIPCOUNT min =0 max = max_neighbor_groups
+            #pragma HLS PIPELINE II=1
+
+            ap_uint<QUERK_TIME_BITS*P> rad2 = rad_2_stream.read();
+            ap_uint<P> valid = valid_stream.read();
+            ap_uint<32*P> weights = neighbor_weights_stream.read();
+            ap_uint<64*P> observables = neighbor_observables_stream.read();
+
+            querk_time time[P];
+            bool candidate[P];
+            ap_uint<32> lane[P];
+            ap_uint<64> lane_observables[P];
+            #pragma HLS ARRAY_PARTITION variable=time complete
+            #pragma HLS ARRAY_PARTITION variable=candidate complete
+            #pragma HLS ARRAY_PARTITION variable=lane complete
+            #pragma HLS ARRAY_PARTITION variable=lane_observables complete
+
+            for(int l=0;l<P;l++){
+                #pragma HLS UNROLL
+                lane_collision(rad1_tmp, rad2.range(QUERK_TIME_BITS*l+QUERK_TIME_BITS-1,QUERK_TIME_BITS*l),
+                    weights.range(32*l+31,32*l), valid[l], time[l], candidate[l]);
+                lane[l] = start_tmp + g*P + l;
+                lane_observables[l] = observables.range(64*l+63,64*l);
             }
-                if (!(rad1_tmp & 1) && (rad2 & 1)) {
-                	//auto
-                    ap_uint<64> collision_time_tmp = weight - ((rad1_tmp >> 2) << 2) - ((rad2 >> 2) << 2);
-                    if (collision_time_tmp < best_time_tmp) {
-                        best_time_tmp = collision_time_tmp;
-                        best_neighbor_tmp = i;
+            if(QUERK_TOP_K == 1){
+                argmin_lanes<P>(time, candidate, lane, lane_observables);
+                if(candidate[0] && time[0] < top_time[0]){
+                    top_time[0] = time[0];
+                    top_neighbor[0] = lane[0];
+                    top_observables[0] = lane_observables[0];
+                }
+            }else{
+                for(int l=0;l<P;l++){
+                    #pragma HLS UNROLL
+                    if(candidate[l]){
+                        insert_candidate(time[l], lane[l], lane_observables[l], top_time, top_neighbor, top_observables);
                     }
                 }
+            }
+        }
+        candidate_words neighbors_out;
+        candidate_observables observables_out;
+        candidate_times times_out;
+        for(int j=0;j<QUERK_TOP_K;j++){
+            #pragma HLS UNROLL
+            neighbors_out.range(32*j+31,32*j) = top_neighbor[j];
+            observables_out.range(64*j+63,64*j) = top_observables[j];
+            times_out.range(QUERK_TIME_BITS*j+QUERK_TIME_BITS-1,QUERK_TIME_BITS*j) = top_time[j];
+        }
+        result_neighbor << neighbors_out;
+        result_observables << observables_out;
+        result_time << times_out;
+    }
+}
 
+// Candidate j of query q goes to entry q*QUERK_TOP_K + j of each array, so the
+// loop writes QUERK_TOP_K entries per port and query. With reduce_min only
+// the batch's earliest event is written: its neighbor, time and observables
+// to slot 0 and its query position to out_neighbor[1] (-1 when no query has
+// an event). Ties go to the earlier query.
+void write_results(ap_uint<32> num_queries, ap_uint<32> reduce_min, hls::stream<candidate_words>& result_neighbor, hls::stream<candidate_observables>& result_observables,
+            hls::stream<candidate_times>& result_time, ap_uint<32> * out_neighbor, ap_uint<64> * out_observables, ap_uint<64> * out_time){
+
+    ap_uint<32> min_query = -1;
+    ap_uint<32> min_neighbor = -1;
+    ap_uint<64> min_observables = 0;
+    querk_time min_time = TIME_NONE;
+
+    for(unsigned int q=0;q<num_queries;q++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_batch_size
+        #pragma HLS PIPELINE II=QUERK_TOP_K
+        candidate_words neighbors = result_neighbor.read();
+        candidate_observables candidate_masks = result_observables.read();
+        candidate_times times = result_time.read();
+        ap_uint<32> neighbor = neighbors.range(31,0);
+        ap_uint<64> observables = candidate_masks.range(63,0);
+        querk_time time = times.range(QUERK_TIME_BITS-1,0);
+        if(!reduce_min){
+            for(int j=0;j<QUERK_TOP_K;j++){
+                querk_time candidate_time = times.range(QUERK_TIME_BITS*j+QUERK_TIME_BITS-1,QUERK_TIME_BITS*j);
+                out_neighbor[q*QUERK_TOP_K+j] = neighbors.range(32*j+31,32*j);
+                out_observables[q*QUERK_TOP_K+j] = candidate_masks.range(64*j+63,64*j);
+                out_time[q*QUERK_TOP_K+j] = widen_time(candidate_time);
+            }
+        }else if(time < min_time){
+            min_query = q;
+            min_neighbor = neighbor;
+            min_observables = observables;
+            min_time = time;
         }
- 
     }
-    *out_neighbor= best_neighbor_tmp;
-    *out_time = best_time_tmp;
+    if(reduce_min){
+        out_neighbor[0] = min_neighbor;
+        out_neighbor[1] = min_query;
+        out_observables[0] = min_observables;
+        out_time[0] = widen_time(min_time);
+    }
+}
 
-    
+// Copies neighbor_offsets and edges into the on-chip cache; the host only asks
+// for it when both fit.
+void load_graph(ap_uint<32> num_nodes, ap_uint<32> * neighbor_offsets, ap_uint<128> * edges){
 
+    for(unsigned int n=0;n<=num_nodes;n++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_cached_nodes
+        #pragma HLS PIPELINE II=1
+        cached_offsets[n] = neighbor_offsets[n];
+    }
+    ap_uint<32> num_edges = cached_offsets[num_nodes];
+    for(unsigned int e=0;e<num_edges;e++){
+        #pragma HLS LOOP_TRIPCOUNT min =1 max = max_cached_edges
+        #pragma HLS PIPELINE II=1
+        cached_edges[e] = edges[e];
+    }
 }
 
-extern "C" void querk(ap_uint<32> detector_node, ap_uint<32> num_nodes, ap_uint<32> num_regions, ap_uint<32> * num_neighbors, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<32> neighbors[][NUM_NEIGHBORS], ap_uint<32> neighbor_weights[][NUM_NEIGHBORS], ap_uint<64> neighbor_observables[][NUM_NEIGHBORS], ap_uint<32> * out_neighbor, ap_uint<64> * out_time) {
+// PATCH_NODE_RADIUS / PATCH_NODE_REGION: one field of a packed record
+void patch_node_state(ap_uint<128> * node_states, ap_uint<32> target, ap_uint<32> index, ap_uint<64> value){
+    #pragma HLS INLINE
+    ap_uint<128> record = node_states[index];
+    if(target == PATCH_NODE_RADIUS){
+        record.range(63,0) = value;
+    }else{
+        record.range(95,64) = value;
+    }
+    node_states[index] = record;
+}
 
-#pragma HLS INTERFACE m_axi port=region_that_arrived_top depth=fifo_in_depth offset=slave bundle=gmem0
-#pragma HLS INTERFACE m_axi port=out_neighbor depth=1 offset=slave bundle=gmem1
-#pragma HLS INTERFACE m_axi port=num_neighbors depth=fifo_in_depth offset=slave bundle=gmem2
-#pragma HLS INTERFACE m_axi port=out_time depth=1 offset=slave bundle=gmem3
-#pragma HLS INTERFACE m_axi port=wrapped_radius_cached depth=fifo_in_depth offset=slave bundle=gmem4
-#pragma HLS INTERFACE m_axi port=radius depth=fifo_in_depth offset=slave bundle=gmem5
-#pragma HLS INTERFACE m_axi port=neighbors depth=fifo_in_depth offset=slave bundle=gmem6
-#pragma HLS INTERFACE m_axi port=neighbor_weights depth=fifo_in_depth offset=slave bundle=gmem7
-#pragma HLS INTERFACE m_axi port=neighbor_observables depth=fifo_in_depth offset=slave bundle=gmem8
+// Writes the host's (target << 32 | index, value) patch list into the
+// device-resident dynamic arrays before any query of the batch is answered.
+void apply_patches(ap_uint<32> num_patches, ap_uint<64> * patches, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<128> * node_states){
+
+    for(unsigned int p=0;p<num_patches;p++){
+        #pragma HLS LOOP_TRIPCOUNT min =0 max = max_patches
+        ap_uint<64> header = patches[2*p];
+        ap_uint<64> value = patches[2*p+1];
+        ap_uint<32> target = header.range(63,32);
+        ap_uint<32> index = header.range(31,0);
+
+        if(target == PATCH_RADIUS){
+            radius[index] = value;
+        }else if(target == PATCH_REGION_THAT_ARRIVED_TOP){
+            region_that_arrived_top[index] = value;
+        }else if(target == PATCH_WRAPPED_RADIUS_CACHED){
+            wrapped_radius_cached[index] = value;
+        }else{
+            patch_node_state(node_states, target, index, value);
+        }
+    }
+}
 
-#pragma HLS INTERFACE s_axilite port=detector_node bundle=control
-#pragma HLS INTERFACE s_axilite port=num_nodes bundle=control
-#pragma HLS INTERFACE s_axilite port=num_regions bundle=control
-#pragma HLS INTERFACE s_axilite port=num_neighbors bundle=control
-#pragma HLS INTERFACE s_axilite port=region_that_arrived_top bundle=control
-//#pragma HLS INTERFACE s_axilite port=m  bundle=control
-#pragma HLS INTERFACE s_axilite port=wrapped_radius_cached bundle=control
-#pragma HLS INTERFACE s_axilite port=radius bundle=control
-#pragma HLS INTERFACE s_axilite port=neighbors bundle=control
-#pragma HLS INTERFACE s_axilite port=neighbor_weights bundle=control
-#pragma HLS INTERFACE s_axilite port=neighbor_observables bundle=control
-#pragma HLS INTERFACE s_axilite port=out_neighbor bundle=control
-#pragma HLS INTERFACE s_axilite port=out_time bundle=control
-#pragma HLS INTERFACE s_axilite port=return bundle=control
+void run_queries(ap_uint<32> num_queries, ap_uint<32> reduce_min, ap_uint<32> * detector_nodes, ap_uint<32> * neighbor_offsets, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<128> * edges, ap_uint<128> * node_states, ap_uint<32> packed_node_states, bool cached_graph, ap_uint<32> * out_neighbor, ap_uint<64> * out_observables, ap_uint<64> * out_time) {
 
-static hls::stream<ap_uint<64> > rad1("rad1_stream");
-static hls::stream<ap_uint<64> > rad1_2("rad1_2_stream");
+static hls::stream<querk_time> rad1("rad1_stream");
+static hls::stream<querk_time> rad1_2("rad1_2_stream");
 
 static hls::stream<ap_uint<32> > rtat("rtat_stream");
 
@@ -234,19 +582,24 @@ static hls::stream<ap_uint<32> > nn("nn_stream");
 static hls::stream<ap_uint<32> > nn_2("nn_2_stream");
 
 static hls::stream<ap_uint<32> > best_neighbor("best_neighbor_stream");
-static hls::stream<ap_uint<64> > collision_time("collision_time_stream");
-static hls::stream<ap_uint<64> > best_time("best_time_stream");
+static hls::stream<ap_uint<64> > best_observables("best_observables_stream");
+static hls::stream<querk_time> collision_time("collision_time_stream");
+static hls::stream<querk_time> best_time("best_time_stream");
 
 static hls::stream<ap_uint<32> > start_1("start_stream");
 static hls::stream<ap_uint<32> > start_2("start_2_stream");
 
 
-static hls::stream<ap_uint<32> > neighbor_weights_stream("neighbor_weights_stream");
-static hls::stream<ap_uint<32> > region_that_arrived_top_stream("region_that_arrived_top_stream");
-static hls::stream<ap_uint<32> > wrapped_radius_cached_stream("wrapped_radius_cached_stream");
-static hls::stream<ap_uint<64> > radius_stream("radius_stream");
-static hls::stream<bool> valid_stream("valid_stream");
-static hls::stream<ap_uint<64> > rad_2_stream("rad_2_stream");
+static hls::stream<neighbor_words> neighbor_weights_stream("neighbor_weights_stream");
+static hls::stream<neighbor_observables> neighbor_observables_stream("neighbor_observables_stream");
+static hls::stream<neighbor_words> region_that_arrived_top_stream("region_that_arrived_top_stream");
+static hls::stream<neighbor_words> wrapped_radius_cached_stream("wrapped_radius_cached_stream");
+static hls::stream<neighbor_times> radius_stream("radius_stream");
+static hls::stream<neighbor_flags> valid_stream("valid_stream");
+static hls::stream<neighbor_times> rad_2_stream("rad_2_stream");
+static hls::stream<candidate_words> result_neighbor("result_neighbor_stream");
+static hls::stream<candidate_observables> result_observables("result_observables_stream");
+static hls::stream<candidate_times> result_time("result_time_stream");
 
 #pragma HLS STREAM variable = rad1 depth = 2
 #pragma HLS STREAM variable = rad1_2 depth = 3
@@ -256,6 +609,7 @@ static hls::stream<ap_uint<64> > rad_2_stream("rad_2_stream");
 #pragma HLS STREAM variable = nn_2 depth = 3
 
 #pragma HLS STREAM variable = best_neighbor depth = 3
+#pragma HLS STREAM variable = best_observables depth = 3
 #pragma HLS STREAM variable = collision_time depth = 3
 #pragma HLS STREAM variable = best_time depth = 3
 #pragma HLS STREAM variable = start_1 depth = 2
@@ -263,50 +617,252 @@ static hls::stream<ap_uint<64> > rad_2_stream("rad_2_stream");
 
 
 #pragma HLS STREAM variable = neighbor_weights_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = neighbor_observables_stream depth = fifo_in_depth
 #pragma HLS STREAM variable = region_that_arrived_top_stream depth = fifo_in_depth
 #pragma HLS STREAM variable = wrapped_radius_cached_stream depth = fifo_in_depth
 #pragma HLS STREAM variable = radius_stream depth = fifo_in_depth
 #pragma HLS STREAM variable = valid_stream depth = fifo_in_depth
 #pragma HLS STREAM variable = rad_2_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = result_neighbor depth = 2
+#pragma HLS STREAM variable = result_observables depth = 2
+#pragma HLS STREAM variable = result_time depth = 2
 
 #pragma HLS dataflow
 
 
-init_data(rad1,
+init_data<QUERK_NEIGHBOR_LANES>(rad1,
             rad1_2,
             rtat,
             nn,
             nn_2,
             best_neighbor,
+            best_observables,
             collision_time,
             best_time,
             start_1,
             start_2,
             neighbor_weights_stream,
+            neighbor_observables_stream,
             wrapped_radius_cached_stream,
             region_that_arrived_top_stream,
             radius_stream,
             region_that_arrived_top,
-            num_neighbors,
+            neighbor_offsets,
             wrapped_radius_cached,
             radius,
-            neighbors,
-            neighbor_weights,
-            detector_node);
+            edges,
+            num_queries,
+            detector_nodes,
+            node_states,
+            packed_node_states,
+            cached_graph);
+
+compute_radius_and_valid<QUERK_NEIGHBOR_LANES>(start_1,valid_stream,rad_2_stream,region_that_arrived_top_stream,wrapped_radius_cached_stream,radius_stream,rad1,rtat,nn,num_queries);
+
+compute_collision<QUERK_NEIGHBOR_LANES>(start_2,best_neighbor,best_observables,best_time,collision_time,rad_2_stream,neighbor_weights_stream,neighbor_observables_stream,valid_stream,rad1_2,nn_2,num_queries,result_neighbor,result_observables,result_time);
+
+write_results(num_queries,reduce_min,result_neighbor,result_observables,result_time,out_neighbor,out_observables,out_time);
+}
+
+extern "C" void querk(ap_uint<32> num_queries, ap_uint<32> * detector_nodes, ap_uint<32> num_patches, ap_uint<64> * patches, ap_uint<32> num_nodes, ap_uint<32> num_regions, ap_uint<32> * neighbor_offsets, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<128> * edges, ap_uint<32> * out_neighbor, ap_uint<64> * out_time, ap_uint<128> * node_states, ap_uint<32> packed_node_states, ap_uint<32> graph_mode, ap_uint<64> * out_observables, ap_uint<32> reduce_min) {
+
+#pragma HLS INTERFACE m_axi port=region_that_arrived_top depth=fifo_in_depth offset=slave bundle=gmem0
+#pragma HLS INTERFACE m_axi port=out_neighbor depth=max_results offset=slave bundle=gmem1
+#pragma HLS INTERFACE m_axi port=neighbor_offsets depth=fifo_in_depth offset=slave bundle=gmem2
+#pragma HLS INTERFACE m_axi port=out_time depth=max_results offset=slave bundle=gmem3
+#pragma HLS INTERFACE m_axi port=wrapped_radius_cached depth=fifo_in_depth offset=slave bundle=gmem4
+#pragma HLS INTERFACE m_axi port=radius depth=fifo_in_depth offset=slave bundle=gmem5
+#pragma HLS INTERFACE m_axi port=edges depth=fifo_in_depth offset=slave bundle=gmem6
+#pragma HLS INTERFACE m_axi port=detector_nodes depth=max_batch_size offset=slave bundle=gmem9
+#pragma HLS INTERFACE m_axi port=patches depth=max_patches offset=slave bundle=gmem10
+#pragma HLS INTERFACE m_axi port=node_states depth=fifo_in_depth offset=slave bundle=gmem11
+#pragma HLS INTERFACE m_axi port=out_observables depth=max_results offset=slave bundle=gmem12
+
+#pragma HLS INTERFACE s_axilite port=num_queries bundle=control
+#pragma HLS INTERFACE s_axilite port=detector_nodes bundle=control
+#pragma HLS INTERFACE s_axilite port=num_patches bundle=control
+#pragma HLS INTERFACE s_axilite port=patches bundle=control
+#pragma HLS INTERFACE s_axilite port=num_nodes bundle=control
+#pragma HLS INTERFACE s_axilite port=num_regions bundle=control
+#pragma HLS INTERFACE s_axilite port=neighbor_offsets bundle=control
+#pragma HLS INTERFACE s_axilite port=region_that_arrived_top bundle=control
+//#pragma HLS INTERFACE s_axilite port=m  bundle=control
+#pragma HLS INTERFACE s_axilite port=wrapped_radius_cached bundle=control
+#pragma HLS INTERFACE s_axilite port=radius bundle=control
+#pragma HLS INTERFACE s_axilite port=edges bundle=control
+#pragma HLS INTERFACE s_axilite port=out_neighbor bundle=control
+#pragma HLS INTERFACE s_axilite port=out_time bundle=control
+#pragma HLS INTERFACE s_axilite port=node_states bundle=control
+#pragma HLS INTERFACE s_axilite port=packed_node_states bundle=control
+#pragma HLS INTERFACE s_axilite port=graph_mode bundle=control
+#pragma HLS INTERFACE s_axilite port=out_observables bundle=control
+#pragma HLS INTERFACE s_axilite port=reduce_min bundle=control
+#pragma HLS INTERFACE s_axilite port=return bundle=control
 
-compute_radius_and_valid(start_1,valid_stream,rad_2_stream,region_that_arrived_top_stream,wrapped_radius_cached_stream,radius_stream,rad1,rtat,nn);
+#pragma HLS BIND_STORAGE variable=cached_offsets type=ram_2p impl=bram
+#pragma HLS BIND_STORAGE variable=cached_edges type=ram_2p impl=uram
+#pragma HLS ARRAY_PARTITION variable=cached_edges type=cyclic factor=QUERK_NEIGHBOR_LANES
 
-compute_collision(start_2,best_neighbor,best_time,collision_time,rad_2_stream,neighbor_weights_stream,valid_stream,rad1_2,nn_2,out_neighbor,out_time);
+if(graph_mode == GRAPH_LOAD){
+    load_graph(num_nodes, neighbor_offsets, edges);
+}
 
+apply_patches(num_patches, patches, radius, region_that_arrived_top, wrapped_radius_cached, node_states);
 
+run_queries(num_queries, reduce_min, detector_nodes, neighbor_offsets, radius, region_that_arrived_top, wrapped_radius_cached, edges, node_states, packed_node_states, graph_mode != GRAPH_HBM, out_neighbor, out_observables, out_time);
 
+}
+
+// The front stage of querk_stream: one command per iteration. A query goes
+// through fetch_query like a batch entry of querk; graph and patch commands
+// update the on-chip arrays this stage owns and push an empty query (no
+// edges, tagged as not a query) so every stage still moves one item.
+template <int P>
+void accept_command(hls::stream<ap_uint<128> >& commands,
+    hls::stream<querk_time>& rad1,
+    hls::stream<querk_time>& rad1_2,
+    hls::stream<ap_uint<32> >& rtat,
+    hls::stream<ap_uint<32> >& nn,
+    hls::stream<ap_uint<32> >& nn_2,
+    hls::stream<ap_uint<32> >& best_neighbor,
+    hls::stream<ap_uint<64> >& best_observables,
+    hls::stream<querk_time>& collision_time,
+    hls::stream<querk_time>& best_time,
+    hls::stream<ap_uint<32> >& start_1,
+    hls::stream<ap_uint<32> >& start_2,
+    hls::stream<ap_uint<32*P> >& neighbor_weights_stream,
+    hls::stream<ap_uint<64*P> >& neighbor_observables_stream,
+    hls::stream<ap_uint<32*P> >& wrapped_radius_cached_stream,
+    hls::stream<ap_uint<32*P> >& region_that_arrived_top_stream,
+    hls::stream<ap_uint<QUERK_TIME_BITS*P> >& radius_stream,
+    hls::stream<ap_uint<33> >& query_tags){
+
+    ap_uint<128> command = commands.read();
+    ap_uint<32> target = command.range(127,96);
+    ap_uint<32> index = command.range(95,64);
+    ap_uint<64> value = command.range(63,0);
+
+    if(target == STREAM_QUERY){
+        // the graph is always on chip and the state always packed
+        fetch_query<P>(rad1, rad1_2, rtat, nn, nn_2, best_neighbor, best_observables, collision_time, best_time, start_1, start_2,
+            neighbor_weights_stream, neighbor_observables_stream, wrapped_radius_cached_stream, region_that_arrived_top_stream, radius_stream,
+            0, 0, 0, 0, 0, index, stream_node_states, 1, true);
+        query_tags << (ap_uint<33>(1) << 32 | index);
+        return;
+    }
 
+    if(target == STREAM_GRAPH_OFFSET){
+        cached_offsets[index] = value;
+    }else if(target == STREAM_GRAPH_EDGE){
+        // no observables: querk_stream leaves them to the host, see emit_result
+        cached_edges[index] = value;
+    }else if(target == PATCH_NODE_RADIUS || target == PATCH_NODE_REGION){
+        patch_node_state(stream_node_states, target, index, value);
+    }
 
+    rtat << -1;
+    rad1 << 0;
+    rad1_2 << 0;
+    nn << 0;
+    nn_2 << 0;
+    start_1 << 0;
+    start_2 << 0;
+    best_neighbor << MAX;
+    best_observables << 0;
+    best_time << TIME_NONE;
+    collision_time << 0;
+    query_tags << 0;
+}
 
+// The back stage of querk_stream: drops the results of the empty queries and
+// emits (node, neighbor, time) of the first candidate for the others
+void emit_result(hls::stream<ap_uint<33> >& query_tags, hls::stream<candidate_words>& result_neighbor,
+    hls::stream<candidate_observables>& result_observables, hls::stream<candidate_times>& result_time, hls::stream<ap_uint<128> >& results){
+
+    ap_uint<33> tag = query_tags.read();
+    ap_uint<32> neighbor = result_neighbor.read().range(31,0);
+    // no room in the result word (nor observables in the streamed edges): the
+    // host looks them up by neighbor
+    result_observables.read();
+    querk_time time = result_time.read().range(QUERK_TIME_BITS-1,0);
+    if(tag[32]){
+        ap_uint<128> result;
+        result.range(127,96) = tag.range(31,0);
+        result.range(95,64) = neighbor;
+        result.range(63,0) = widen_time(time);
+        results << result;
+    }
+}
 
+// Free-running variant of querk: no control registers, no start/done. The
+// dataflow region below restarts by itself and takes one command from the
+// commands stream per iteration, so queries follow each other through the
+// stages without a host round trip. See kernel_simple.h for the words.
+extern "C" void querk_stream(hls::stream<ap_uint<128> >& commands, hls::stream<ap_uint<128> >& results) {
+
+#pragma HLS INTERFACE axis port=commands
+#pragma HLS INTERFACE axis port=results
+#pragma HLS INTERFACE ap_ctrl_none port=return
+
+#pragma HLS BIND_STORAGE variable=cached_offsets type=ram_2p impl=bram
+#pragma HLS BIND_STORAGE variable=cached_edges type=ram_2p impl=uram
+#pragma HLS ARRAY_PARTITION variable=cached_edges type=cyclic factor=QUERK_NEIGHBOR_LANES
+#pragma HLS BIND_STORAGE variable=stream_node_states type=ram_2p impl=uram
+
+static hls::stream<querk_time> rad1("stream_rad1_stream");
+static hls::stream<querk_time> rad1_2("stream_rad1_2_stream");
+static hls::stream<ap_uint<32> > rtat("stream_rtat_stream");
+static hls::stream<ap_uint<32> > nn("stream_nn_stream");
+static hls::stream<ap_uint<32> > nn_2("stream_nn_2_stream");
+static hls::stream<ap_uint<32> > best_neighbor("stream_best_neighbor_stream");
+static hls::stream<ap_uint<64> > best_observables("stream_best_observables_stream");
+static hls::stream<querk_time> collision_time("stream_collision_time_stream");
+static hls::stream<querk_time> best_time("stream_best_time_stream");
+static hls::stream<ap_uint<32> > start_1("stream_start_stream");
+static hls::stream<ap_uint<32> > start_2("stream_start_2_stream");
+static hls::stream<neighbor_words> neighbor_weights_stream("stream_neighbor_weights_stream");
+static hls::stream<neighbor_observables> neighbor_observables_stream("stream_neighbor_observables_stream");
+static hls::stream<neighbor_words> region_that_arrived_top_stream("stream_region_that_arrived_top_stream");
+static hls::stream<neighbor_words> wrapped_radius_cached_stream("stream_wrapped_radius_cached_stream");
+static hls::stream<neighbor_times> radius_stream("stream_radius_stream");
+static hls::stream<neighbor_flags> valid_stream("stream_valid_stream");
+static hls::stream<neighbor_times> rad_2_stream("stream_rad_2_stream");
+static hls::stream<candidate_words> result_neighbor("stream_result_neighbor_stream");
+static hls::stream<candidate_observables> result_observables("stream_result_observables_stream");
+static hls::stream<candidate_times> result_time("stream_result_time_stream");
+static hls::stream<ap_uint<33> > query_tags("stream_query_tags_stream");
 
+#pragma HLS STREAM variable = rad1 depth = 2
+#pragma HLS STREAM variable = rad1_2 depth = 3
+#pragma HLS STREAM variable = rtat depth = 2
+#pragma HLS STREAM variable = nn depth = 2
+#pragma HLS STREAM variable = nn_2 depth = 3
+#pragma HLS STREAM variable = best_neighbor depth = 3
+#pragma HLS STREAM variable = best_observables depth = 3
+#pragma HLS STREAM variable = collision_time depth = 3
+#pragma HLS STREAM variable = best_time depth = 3
+#pragma HLS STREAM variable = start_1 depth = 2
+#pragma HLS STREAM variable = start_2 depth = 3
+#pragma HLS STREAM variable = neighbor_weights_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = neighbor_observables_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = region_that_arrived_top_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = wrapped_radius_cached_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = radius_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = valid_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = rad_2_stream depth = fifo_in_depth
+#pragma HLS STREAM variable = result_neighbor depth = 2
+#pragma HLS STREAM variable = result_observables depth = 2
+#pragma HLS STREAM variable = result_time depth = 2
+#pragma HLS STREAM variable = query_tags depth = 4
+
+#pragma HLS dataflow
 
+accept_command<QUERK_NEIGHBOR_LANES>(commands,rad1,rad1_2,rtat,nn,nn_2,best_neighbor,best_observables,collision_time,best_time,start_1,start_2,
+            neighbor_weights_stream,neighbor_observables_stream,wrapped_radius_cached_stream,region_that_arrived_top_stream,radius_stream,query_tags);
 
+compute_radius_and_valid<QUERK_NEIGHBOR_LANES>(start_1,valid_stream,rad_2_stream,region_that_arrived_top_stream,wrapped_radius_cached_stream,radius_stream,rad1,rtat,nn,1);
 
+compute_collision<QUERK_NEIGHBOR_LANES>(start_2,best_neighbor,best_observables,best_time,collision_time,rad_2_stream,neighbor_weights_stream,neighbor_observables_stream,valid_stream,rad1_2,nn_2,1,result_neighbor,result_observables,result_time);
 
+emit_result(query_tags,result_neighbor,result_observables,result_time,results);
 }
@@ -1,11 +1,32 @@
 #ifndef KERNEL_SIMPLE_H
 #define KERNEL_SIMPLE_H
 
-#define NUM_NODES 100
-#define NUM_REGIONS 10
-#define NUM_NEIGHBORS 2
-#define MAX 9223372036854775807
+#include <hls_stream.h>
+#include "querk_params.h"
 
-extern "C" void querk(ap_uint<32> detector_node, ap_uint<32> num_nodes, ap_uint<32> num_regions, ap_uint<32> * num_neighbors, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<32> neighbors[][NUM_NEIGHBORS], ap_uint<32> neighbor_weights[][NUM_NEIGHBORS], ap_uint<64> neighbor_observables[][NUM_NEIGHBORS], ap_uint<32> * out_neighbor, ap_uint<64> * out_time);
+// Edges come in as edge records (see next_event.h), one 128-bit word per CSR
+// slot. packed_node_states selects where the queries read the dynamic state: 0 for
+// radius / region_that_arrived_top / wrapped_radius_cached, 1 for the packed
+// node_states records (see next_event.h). apply_patches serves both layouts.
+// graph_mode is one of GRAPH_HBM / GRAPH_LOAD / GRAPH_CACHED (querk_params.h);
+// the on-chip graph is static, so like the streams it is shared by every call.
+// out_observables gets the observable mask of each query's winning edge (bits
+// 127..64 of its edge record), 0 when there is no event. Built with
+// QUERK_TOP_K above 1, every output array holds that many candidates per
+// query, earliest first (find_next_events_top_k in next_event.h); querk_stream
+// still emits the first one only. With reduce_min set
+// the batch is reduced to its earliest event instead, for region-scope queries
+// over a region's frontier: neighbor, time and observables go to slot 0 and
+// the winning query's position to out_neighbor[1], -1 when there is no event.
+
+// querk_stream is the free-running form (ap_ctrl_none, AXI4-Stream only) for a
+// packed graph that fits on chip: it takes one command word (querk_params.h)
+// per iteration, keeps the graph and the packed node records on chip, and
+// writes a (node << 96 | neighbor << 64 | time) result word for every query,
+// in command order. The graph and records are loaded through the same stream.
+
+extern "C" void querk(ap_uint<32> num_queries, ap_uint<32> * detector_nodes, ap_uint<32> num_patches, ap_uint<64> * patches, ap_uint<32> num_nodes, ap_uint<32> num_regions, ap_uint<32> * neighbor_offsets, ap_uint<64> * radius, ap_uint<32> * region_that_arrived_top, ap_uint<32> * wrapped_radius_cached, ap_uint<128> * edges, ap_uint<32> * out_neighbor, ap_uint<64> * out_time, ap_uint<128> * node_states, ap_uint<32> packed_node_states, ap_uint<32> graph_mode, ap_uint<64> * out_observables, ap_uint<32> reduce_min);
+
+extern "C" void querk_stream(hls::stream<ap_uint<128> >& commands, hls::stream<ap_uint<128> >& results);
 
 #endif
@@ -0,0 +1,472 @@
+#include "next_event.h"
+#include <algorithm>
+
+std::pair<size_t, uint64_t > find_next_event_at_node_occupied_by_growing_top_region(
+	uint32_t detector_node,
+	uint64_t rad1,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius)
+
+	{
+	uint64_t best_time = MAX;
+	uint32_t best_neighbor = MAX;
+	uint32_t first = neighbor_offsets[detector_node];
+	uint32_t num_neighbors = neighbor_offsets[detector_node + 1] - first;
+	uint32_t start = 0;
+    if (!(num_neighbors==0) && neighbors[first] == -1) {
+        // Growing towards boundary
+    	uint32_t weight = neighbor_weights[first];
+    	uint64_t collision_time = weight - ((rad1 >> 2)<<2);
+        if (collision_time < best_time) {
+            best_time = collision_time;
+            best_neighbor = 0;
+        }
+        start++;
+    }
+
+    // Handle non-boundary neighbors.
+    for (uint32_t i = start; i < num_neighbors; i++) {
+        
+    	uint32_t weight = neighbor_weights[first + i];
+
+    	uint32_t neighbor = neighbors[first + i];
+
+        if (region_that_arrived_top[detector_node] == region_that_arrived_top[neighbor]) {
+            continue;
+        }
+        uint64_t rad2;
+
+		if (region_that_arrived_top[neighbor] == -1) {
+				rad2 = 0;
+		} else {
+			rad2 = radius[region_that_arrived_top[neighbor]] +(wrapped_radius_cached[neighbor] << 2);
+		}
+
+        if (rad2 & 2) {
+            continue;
+        }
+
+        uint64_t collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
+        if (rad2 & 1) {
+            collision_time >>= 1;
+        }
+        if (collision_time < best_time) {
+            best_time = collision_time;
+            best_neighbor = i;
+        }
+    }
+    return {best_neighbor, best_time};
+}
+
+std::pair<size_t, uint64_t > find_next_event_at_node_not_occupied_by_growing_top_region(
+	uint32_t detector_node,
+	uint64_t rad1,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius)
+
+{
+	uint64_t best_time = MAX;
+	uint32_t best_neighbor = MAX;
+	uint32_t first = neighbor_offsets[detector_node];
+	uint32_t num_neighbors = neighbor_offsets[detector_node + 1] - first;
+
+	uint32_t start = 0;
+    if (!(num_neighbors==0) && neighbors[first] == -1)
+        start++;
+
+    // Handle non-boundary neighbors.
+    for (uint32_t i = start; i < num_neighbors; i++) {
+        
+    	uint32_t weight = neighbor_weights[first + i];
+
+    	uint32_t neighbor = neighbors[first + i];
+
+    	uint64_t rad2;
+
+		if (region_that_arrived_top[neighbor] == -1) {
+				rad2 = 0;
+		} else {
+			rad2 = radius[region_that_arrived_top[neighbor]] +(wrapped_radius_cached[neighbor] << 2);
+		}
+
+        if (rad2 & 1) {
+            auto collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
+            if (collision_time < best_time) {
+                best_time = collision_time;
+                best_neighbor = i;
+            }
+        }
+    }
+    return {best_neighbor, best_time};
+}
+
+std::pair<size_t, uint64_t > find_next_event_at_node_returning_neighbor_index_and_time(
+    uint32_t detector_node,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius)
+{
+	uint64_t rad1;
+
+	if (region_that_arrived_top[detector_node] == -1) {
+			rad1 = 0;
+	} else {
+		rad1 = radius[region_that_arrived_top[detector_node]] + (wrapped_radius_cached[detector_node] << 2);
+	}
+
+
+    if (rad1 & 1) {
+        return find_next_event_at_node_occupied_by_growing_top_region(detector_node, rad1, neighbor_offsets, neighbors, neighbor_weights, region_that_arrived_top, wrapped_radius_cached, radius);
+    } else {
+        return find_next_event_at_node_not_occupied_by_growing_top_region(detector_node, rad1, neighbor_offsets, neighbors, neighbor_weights, region_that_arrived_top, wrapped_radius_cached, radius);
+    }
+}
+
+// Batched counterpart of the querk kernel: answers num_queries nodes in one call
+// and writes one (neighbor, time) pair per query.
+void find_next_event_at_nodes_returning_neighbor_index_and_time(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    for (uint32_t q = 0; q < num_queries; q++) {
+        auto event = find_next_event_at_node_returning_neighbor_index_and_time(detector_nodes[q], neighbor_offsets, neighbors, neighbor_weights, region_that_arrived_top, wrapped_radius_cached, radius);
+        out_neighbor[q] = event.first;
+        out_time[q] = event.second;
+    }
+}
+
+node_state resolve_node_state(
+	uint32_t node,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius)
+{
+	node_state state;
+	state.region = region_that_arrived_top[node];
+	state.reserved = 0;
+	if (state.region == (uint32_t) -1) {
+		state.radius = 0;
+	} else {
+		state.radius = radius[state.region] + (wrapped_radius_cached[node] << 2);
+	}
+	return state;
+}
+
+void pack_node_states(
+	uint32_t num_nodes,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	node_state * node_states)
+{
+	for (uint32_t n = 0; n < num_nodes; n++) {
+		node_states[n] = resolve_node_state(n, region_that_arrived_top, wrapped_radius_cached, radius);
+	}
+}
+
+void pack_edge_records(
+	uint32_t num_edges,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint64_t * neighbor_observables,
+	edge_record * edges)
+{
+	for (uint32_t e = 0; e < num_edges; e++) {
+		edges[e].neighbor = neighbors[e];
+		edges[e].weight = neighbor_weights[e];
+		edges[e].observables = neighbor_observables[e];
+	}
+}
+
+static std::pair<size_t, uint64_t > find_next_event_at_node_packed(
+    uint32_t detector_node,
+	uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states)
+{
+	uint64_t best_time = MAX;
+	uint32_t best_neighbor = (uint32_t) -1;
+	uint64_t rad1 = node_states[detector_node].radius;
+	uint32_t region = node_states[detector_node].region;
+	bool growing = rad1 & 1;
+	uint32_t first = neighbor_offsets[detector_node];
+	uint32_t num_neighbors = neighbor_offsets[detector_node + 1] - first;
+
+	uint32_t start = 0;
+    if (!(num_neighbors==0) && edges[first].neighbor == (uint32_t) -1) {
+        // Growing towards boundary
+        uint64_t collision_time = edges[first].weight - ((rad1 >> 2) << 2);
+        if (growing && collision_time < best_time) {
+            best_time = collision_time;
+            best_neighbor = 0;
+        }
+        start++;
+    }
+
+    for (uint32_t i = start; i < num_neighbors; i++) {
+    	const edge_record & edge = edges[first + i];
+    	uint32_t weight = edge.weight;
+    	const node_state & neighbor = node_states[edge.neighbor];
+    	uint64_t rad2 = neighbor.radius;
+    	uint64_t collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
+
+        if (growing) {
+            if (region == neighbor.region || (rad2 & 2)) {
+                continue;
+            }
+            if (rad2 & 1) {
+                collision_time >>= 1;
+            }
+        } else if (!(rad2 & 1)) {
+            continue;
+        }
+        if (collision_time < best_time) {
+            best_time = collision_time;
+            best_neighbor = i;
+        }
+    }
+    return {best_neighbor, best_time};
+}
+
+void find_next_event_at_nodes_packed_returning_neighbor_index_and_time(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+    for (uint32_t q = 0; q < num_queries; q++) {
+        auto event = find_next_event_at_node_packed(detector_nodes[q], neighbor_offsets, edges, node_states);
+        out_neighbor[q] = event.first;
+        out_time[q] = event.second;
+    }
+}
+
+// Time of the event along one edge of a node with record (rad1, region), the
+// loop bodies of the functions above for a single neighbor; MAX or above when
+// the edge has none. A boundary edge only counts for a growing node.
+static uint64_t edge_event_time(uint64_t rad1, uint32_t region, uint32_t neighbor, uint32_t weight, const node_state & other)
+{
+	bool growing = rad1 & 1;
+	if (neighbor == (uint32_t) -1) {
+		return growing ? weight - ((rad1 >> 2) << 2) : (uint64_t) MAX;
+	}
+	uint64_t rad2 = other.radius;
+	uint64_t collision_time = weight - ((rad1 >> 2) << 2) - ((rad2 >> 2) << 2);
+	if (growing) {
+		if (region == other.region || (rad2 & 2)) {
+			return MAX;
+		}
+		if (rad2 & 1) {
+			collision_time >>= 1;
+		}
+	} else if (!(rad2 & 1)) {
+		return MAX;
+	}
+	return collision_time;
+}
+
+// Keeps out_neighbor / out_time the k earliest events seen so far, sorted; an
+// event tying with a listed one goes after it, so ties stay in edge order.
+static void insert_candidate(uint32_t k, uint32_t neighbor, uint64_t time, uint32_t * out_neighbor, uint64_t * out_time)
+{
+	if (!(time < out_time[k - 1])) {
+		return;
+	}
+	uint32_t j = k - 1;
+	for (; j > 0 && time < out_time[j - 1]; j--) {
+		out_neighbor[j] = out_neighbor[j - 1];
+		out_time[j] = out_time[j - 1];
+	}
+	out_neighbor[j] = neighbor;
+	out_time[j] = time;
+}
+
+// Top-k scan of one node for either layout: edge(i) is the (neighbor, weight)
+// of slot i and state(n) the record of node n.
+template <typename Edge, typename State>
+static void find_top_k_at_node(uint32_t k, uint32_t detector_node, const uint32_t * neighbor_offsets, Edge edge, State state,
+	uint32_t * out_neighbor, uint64_t * out_time)
+{
+	for (uint32_t j = 0; j < k; j++) {
+		out_neighbor[j] = (uint32_t) -1;
+		out_time[j] = MAX;
+	}
+	node_state self = state(detector_node);
+	uint32_t first = neighbor_offsets[detector_node];
+	uint32_t num_neighbors = neighbor_offsets[detector_node + 1] - first;
+	for (uint32_t i = 0; i < num_neighbors; i++) {
+		std::pair<uint32_t, uint32_t> e = edge(first + i);
+		node_state other = e.first == (uint32_t) -1 ? self : state(e.first);
+		insert_candidate(k, i, edge_event_time(self.radius, self.region, e.first, e.second, other), out_neighbor, out_time);
+	}
+}
+
+void find_next_events_top_k(
+	uint32_t k,
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+	auto edge = [&](uint32_t e) { return std::make_pair(neighbors[e], neighbor_weights[e]); };
+	auto state = [&](uint32_t n) { return resolve_node_state(n, region_that_arrived_top, wrapped_radius_cached, radius); };
+    for (uint32_t q = 0; q < num_queries; q++) {
+        find_top_k_at_node(k, detector_nodes[q], neighbor_offsets, edge, state, out_neighbor + q*k, out_time + q*k);
+    }
+}
+
+void find_next_events_top_k_packed(
+	uint32_t k,
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time)
+{
+	auto edge = [&](uint32_t e) { return std::make_pair(edges[e].neighbor, edges[e].weight); };
+	auto state = [&](uint32_t n) { return node_states[n]; };
+    for (uint32_t q = 0; q < num_queries; q++) {
+        find_top_k_at_node(k, detector_nodes[q], neighbor_offsets, edge, state, out_neighbor + q*k, out_time + q*k);
+    }
+}
+
+bool next_event_from_candidates(
+	uint32_t k,
+	const uint32_t * candidate_neighbor,
+	const uint64_t * candidate_time,
+	uint32_t num_changed,
+	const uint32_t * changed_slots,
+    uint32_t detector_node,
+	const uint32_t * neighbor_offsets,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	uint32_t & out_neighbor,
+	uint64_t & out_time)
+{
+	out_neighbor = (uint32_t) -1;
+	out_time = MAX;
+	// the candidates on unchanged edges keep their times
+	for (uint32_t j = 0; j < k && candidate_neighbor[j] != (uint32_t) -1; j++) {
+		if (std::find(changed_slots, changed_slots + num_changed, candidate_neighbor[j]) == changed_slots + num_changed) {
+			out_neighbor = candidate_neighbor[j];
+			out_time = candidate_time[j];
+			break;
+		}
+	}
+	// the changed edges are evaluated afresh
+	node_state self = resolve_node_state(detector_node, region_that_arrived_top, wrapped_radius_cached, radius);
+	uint32_t first = neighbor_offsets[detector_node];
+	for (uint32_t c = 0; c < num_changed; c++) {
+		uint32_t i = changed_slots[c];
+		uint32_t neighbor = neighbors[first + i];
+		node_state other = neighbor == (uint32_t) -1 ? self : resolve_node_state(neighbor, region_that_arrived_top, wrapped_radius_cached, radius);
+		uint64_t time = edge_event_time(self.radius, self.region, neighbor, neighbor_weights[first + i], other);
+		if (time < out_time || (time == out_time && time < (uint64_t) MAX && i < out_neighbor)) {
+			out_neighbor = i;
+			out_time = time;
+		}
+	}
+	// An edge left off a full list is no earlier than its last candidate, so
+	// only an event strictly before that is certain
+	bool full = candidate_neighbor[k - 1] != (uint32_t) -1;
+	return !full || out_time < candidate_time[k - 1];
+}
+
+void find_next_event_observables(
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const uint64_t * neighbor_observables,
+	const uint32_t * out_neighbor,
+	uint64_t * out_observables,
+	uint32_t candidates)
+{
+    for (uint32_t q = 0; q < num_queries*candidates; q++) {
+        uint32_t index = out_neighbor[q];
+        out_observables[q] = index == (uint32_t) -1 ? 0 : neighbor_observables[neighbor_offsets[detector_nodes[q / candidates]] + index];
+    }
+}
+
+void find_next_event_observables_packed(
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const uint32_t * out_neighbor,
+	uint64_t * out_observables,
+	uint32_t candidates)
+{
+    for (uint32_t q = 0; q < num_queries*candidates; q++) {
+        uint32_t index = out_neighbor[q];
+        out_observables[q] = index == (uint32_t) -1 ? 0 : edges[neighbor_offsets[detector_nodes[q / candidates]] + index].observables;
+    }
+}
+
+uint32_t time_bits_for(uint64_t max_weight, uint64_t max_local_radius) {
+	for (uint32_t bits = 16; bits < 64; bits *= 2) {
+		uint64_t limit = (uint64_t) 1 << (bits - 2);
+		if (max_weight < limit && max_local_radius < limit) {
+			return bits;
+		}
+	}
+	return 64;
+}
+
+uint32_t max_edge_weight(uint32_t num_edges, const uint32_t * neighbor_weights) {
+	uint32_t max_weight = 0;
+	for (uint32_t e = 0; e < num_edges; e++) {
+		max_weight = std::max(max_weight, neighbor_weights[e]);
+	}
+	return max_weight;
+}
+
+// A bound rather than the exact maximum: the largest radius word plus the
+// largest wrapped part, whichever nodes they belong to
+uint64_t max_local_radius(
+	uint32_t num_nodes,
+	uint32_t num_regions,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius) {
+	uint64_t max_radius = 0;
+	uint64_t max_wrapped = 0;
+	for (uint32_t r = 0; r < num_regions; r++) {
+		max_radius = std::max(max_radius, radius[r]);
+	}
+	for (uint32_t n = 0; n < num_nodes; n++) {
+		max_wrapped = std::max(max_wrapped, (uint64_t) wrapped_radius_cached[n]);
+	}
+	return max_radius + (max_wrapped << 2);
+}
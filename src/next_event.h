@@ -0,0 +1,221 @@
+#ifndef NEXT_EVENT_H
+#define NEXT_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include "querk_params.h"
+
+// Golden (software) versions of the querk kernel. A radius word is
+// (y_intercept << 2) | flags, where flag 1 marks a growing region and flag 2
+// a shrinking one; a node's local radius is radius[region_that_arrived_top]
+// + (wrapped_radius_cached << 2), or 0 when region_that_arrived_top is -1.
+//
+// The graph is in compressed sparse row form: the edges of a node are
+// neighbors[neighbor_offsets[node] .. neighbor_offsets[node + 1]) with the
+// matching entries of neighbor_weights, and neighbor indices are counted from
+// the node's first edge. A -1 as a node's first neighbor is the edge to the
+// boundary.
+
+// Optional packed layout of the dynamic state: one 16-byte record per node
+// holding its local radius, already resolved as above, and its
+// region_that_arrived_top. A neighbor then costs one load instead of the chain
+// region_that_arrived_top -> radius plus wrapped_radius_cached. The host keeps
+// the records current through state_patches; the kernel sees the same bits as
+// one ap_uint<128> (radius in bits 63..0, region in bits 95..64).
+struct node_state {
+	uint64_t radius;
+	uint32_t region;
+	uint32_t reserved;
+} __attribute__((aligned(16)));
+
+node_state resolve_node_state(
+	uint32_t node,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius);
+
+void pack_node_states(
+	uint32_t num_nodes,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	node_state * node_states);
+
+// Edge record: neighbor, weight and observable mask of one CSR slot in 16
+// bytes, so an edge is one load (one burst on the device) instead of one from
+// each of neighbors, neighbor_weights and neighbor_observables. The kernel
+// always reads edges in this form, as an ap_uint<128> with the neighbor in bits
+// 31..0, the weight in bits 63..32 and the observables in bits 127..64.
+struct edge_record {
+	uint32_t neighbor;
+	uint32_t weight;
+	uint64_t observables;
+} __attribute__((aligned(16)));
+
+void pack_edge_records(
+	uint32_t num_edges,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint64_t * neighbor_observables,
+	edge_record * edges);
+
+std::pair<size_t, uint64_t > find_next_event_at_node_occupied_by_growing_top_region(
+	uint32_t detector_node,
+	uint64_t rad1,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius);
+
+std::pair<size_t, uint64_t > find_next_event_at_node_not_occupied_by_growing_top_region(
+	uint32_t detector_node,
+	uint64_t rad1,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius);
+
+std::pair<size_t, uint64_t > find_next_event_at_node_returning_neighbor_index_and_time(
+    uint32_t detector_node,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius);
+
+void find_next_event_at_nodes_returning_neighbor_index_and_time(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	uint32_t * neighbors,
+	uint32_t * neighbor_weights,
+	uint32_t * region_that_arrived_top,
+	uint32_t * wrapped_radius_cached,
+	uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+// Observable mask of the edge each query's event runs along, given the
+// out_neighbor of the query, or 0 where there is no event (out_neighbor -1).
+// The kernel returns the same masks along with its results. With candidates
+// above 1 there are that many out_neighbor entries per query, as returned by
+// find_next_events_top_k.
+void find_next_event_observables(
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const uint64_t * neighbor_observables,
+	const uint32_t * out_neighbor,
+	uint64_t * out_observables,
+	uint32_t candidates = 1);
+
+void find_next_event_observables_packed(
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const uint32_t * out_neighbor,
+	uint64_t * out_observables,
+	uint32_t candidates = 1);
+
+// The k earliest events at each node instead of the first only:
+// out_neighbor[q*k + j] / out_time[q*k + j] is candidate j of query q, sorted
+// by time with ties in edge order, padded with (-1, MAX). Candidate 0 is what
+// find_next_event_at_nodes_returning_neighbor_index_and_time returns. The
+// kernel built with QUERK_TOP_K returns the same lists.
+void find_next_events_top_k(
+	uint32_t k,
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+void find_next_events_top_k_packed(
+	uint32_t k,
+    uint32_t num_queries,
+    const uint32_t * detector_nodes,
+	const uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+// Falls back on a node's k candidates instead of querying it again, after
+// the neighbors at the edge slots changed_slots changed state and nothing else
+// around the node did (its own record included). The changed edges are
+// evaluated against the current arrays and the first candidate on an
+// unchanged edge keeps its time; returns false when the result is not
+// certain, i.e. a full list whose edges left off could be earlier, and the
+// node has to be queried again.
+bool next_event_from_candidates(
+	uint32_t k,
+	const uint32_t * candidate_neighbor,
+	const uint64_t * candidate_time,
+	uint32_t num_changed,
+	const uint32_t * changed_slots,
+    uint32_t detector_node,
+	const uint32_t * neighbor_offsets,
+	const uint32_t * neighbors,
+	const uint32_t * neighbor_weights,
+	const uint32_t * region_that_arrived_top,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius,
+	uint32_t & out_neighbor,
+	uint64_t & out_time);
+
+// Narrow datapaths. Collision times computed modulo 2^bits come out as the
+// 64-bit ones once widened by widen_time(), as long as every weight and every
+// local radius word is below 2^(bits - 2): a time then lies in
+// (-2^(bits - 1), 2^(bits - 2)), and the 64-bit path sees negative times
+// sign-extended and negative times of two growing regions halved to just
+// below 2^63, three bands that keep their order at either width. The "no
+// event" time MAX is time_none(bits), widened.
+uint32_t time_bits_for(uint64_t max_weight, uint64_t max_local_radius);
+
+static inline uint64_t time_none(uint32_t bits) {
+	return ((uint64_t) 1 << (bits - 1)) - 1;
+}
+
+static inline uint64_t widen_time(uint64_t time, uint32_t bits) {
+	if (bits == 64 || time < ((uint64_t) 1 << (bits - 2))) {
+		return time;
+	}
+	if (time < ((uint64_t) 1 << (bits - 1))) {
+		return time + ((uint64_t) 1 << 63) - ((uint64_t) 1 << (bits - 1));
+	}
+	return time - ((uint64_t) 1 << bits);
+}
+
+// Largest weight and largest local radius word of a graph and its state
+uint32_t max_edge_weight(uint32_t num_edges, const uint32_t * neighbor_weights);
+uint64_t max_local_radius(
+	uint32_t num_nodes,
+	uint32_t num_regions,
+	const uint32_t * wrapped_radius_cached,
+	const uint64_t * radius);
+
+// Same results as find_next_event_at_nodes_returning_neighbor_index_and_time,
+// reading the edge and node records instead of the edge arrays and the three
+// dynamic arrays.
+void find_next_event_at_nodes_packed_returning_neighbor_index_and_time(
+    uint32_t num_queries,
+    uint32_t * detector_nodes,
+	uint32_t * neighbor_offsets,
+	const edge_record * edges,
+	const node_state * node_states,
+	uint32_t * out_neighbor,
+	uint64_t * out_time);
+
+#endif
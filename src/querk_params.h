@@ -0,0 +1,73 @@
+#ifndef QUERK_PARAMS_H
+#define QUERK_PARAMS_H
+
+// Constants shared by the querk kernel and every host-side user of its arrays.
+// Graph size, degrees and number of regions are all runtime values: the edges
+// are stored in compressed sparse row form (see next_event.h), so one build
+// serves any detector graph.
+
+#define MAX 9223372036854775807
+
+// Patch words, see state_patches.h
+#define MAX_PATCHES 4096
+#define PATCH_RADIUS 0
+#define PATCH_REGION_THAT_ARRIVED_TOP 1
+#define PATCH_WRAPPED_RADIUS_CACHED 2
+// fields of a packed node record (see node_state in next_event.h)
+#define PATCH_NODE_RADIUS 3
+#define PATCH_NODE_REGION 4
+
+// Where the kernel reads neighbor_offsets and edges from. GRAPH_LOAD copies
+// them into on-chip memory and answers from there, GRAPH_CACHED answers from
+// the copy a previous GRAPH_LOAD call left behind. Graphs above the on-chip
+// capacity stay on GRAPH_HBM.
+#define GRAPH_HBM 0
+#define GRAPH_LOAD 1
+#define GRAPH_CACHED 2
+#define MAX_CACHED_NODES 16384
+#define MAX_CACHED_EDGES 65536
+
+// Command words of the free-running querk_stream kernel: (target << 32 | index)
+// in bits 127..64 and a value in bits 63..0, the two patch words side by side,
+// so PATCH_NODE_RADIUS / PATCH_NODE_REGION patches go in unchanged. The other
+// targets:
+// a query for detector node index
+#define STREAM_QUERY 8
+// neighbor_offsets[index] = value, for index 0 .. num_nodes
+#define STREAM_GRAPH_OFFSET 9
+// edge index is (weight << 32 | neighbor), the low half of its edge record
+#define STREAM_GRAPH_EDGE 10
+
+// Width of the kernel's radius and time datapath (the rad / time FIFOs and
+// the collision arithmetic): 64, or 32 / 16 for graphs whose weights and
+// local radii time_bits_for() (next_event.h) accepts at that width. Memory
+// layouts and out_time stay 64 bits wide. Host and kernel must be built with
+// the same value.
+#ifndef QUERK_TIME_BITS
+#define QUERK_TIME_BITS 64
+#endif
+
+// Neighbor slots the kernel's compute stages evaluate per cycle, reduced by a
+// tree argmin; a power of two. Results do not depend on it, so the host only
+// needs the same value to run the same kernel on the CPU backends.
+#ifndef QUERK_NEIGHBOR_LANES
+#define QUERK_NEIGHBOR_LANES 1
+#endif
+#if QUERK_NEIGHBOR_LANES < 1 || (QUERK_NEIGHBOR_LANES & (QUERK_NEIGHBOR_LANES - 1)) != 0
+#error "QUERK_NEIGHBOR_LANES must be a power of two"
+#endif
+
+// Candidate events the kernel returns per query: the QUERK_TOP_K earliest,
+// sorted by time with ties in edge order and padded with "no event", so the
+// host can fall back to the next one when the first is invalidated (see
+// next_event_from_candidates in next_event.h). Every out_neighbor / out_time /
+// out_observables array then holds QUERK_TOP_K entries per query; host and
+// kernel must be built with the same value.
+#ifndef QUERK_TOP_K
+#define QUERK_TOP_K 1
+#endif
+#if QUERK_TOP_K < 1 || QUERK_TOP_K > 8
+#error "QUERK_TOP_K must be between 1 and 8"
+#endif
+
+#endif
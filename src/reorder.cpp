@@ -0,0 +1,109 @@
+#include "reorder.h"
+#include <algorithm>
+
+#define BOUNDARY ((uint32_t) -1)
+
+void identity_permutation(uint32_t num_nodes, node_permutation & perm) {
+    perm.to_internal.resize(num_nodes);
+    perm.to_original.resize(num_nodes);
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        perm.to_internal[n] = n;
+        perm.to_original[n] = n;
+    }
+}
+
+void reverse_cuthill_mckee(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, node_permutation & perm) {
+    std::vector<uint32_t> degree(num_nodes);
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        degree[n] = neighbor_offsets[n + 1] - neighbor_offsets[n];
+    }
+    auto by_degree = [&degree](uint32_t a, uint32_t b) {
+        return degree[a] < degree[b] || (degree[a] == degree[b] && a < b);
+    };
+
+    // components are started in this order
+    std::vector<uint32_t> starts(num_nodes);
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        starts[n] = n;
+    }
+    std::sort(starts.begin(), starts.end(), by_degree);
+
+    // order doubles as the BFS queue
+    std::vector<uint32_t> & order = perm.to_original;
+    order.clear();
+    order.reserve(num_nodes);
+    std::vector<bool> visited(num_nodes, false);
+    for (uint32_t s = 0; s < num_nodes; s++) {
+        if (visited[starts[s]]) {
+            continue;
+        }
+        visited[starts[s]] = true;
+        order.push_back(starts[s]);
+        for (size_t head = order.size() - 1; head < order.size(); head++) {
+            uint32_t node = order[head];
+            size_t first_new = order.size();
+            for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+                uint32_t neighbor = neighbors[e];
+                if (neighbor != BOUNDARY && !visited[neighbor]) {
+                    visited[neighbor] = true;
+                    order.push_back(neighbor);
+                }
+            }
+            std::sort(order.begin() + first_new, order.end(), by_degree);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    perm.to_internal.resize(num_nodes);
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        perm.to_internal[order[i]] = i;
+    }
+}
+
+void permute_csr(const node_permutation & perm,
+    std::vector<uint32_t> & neighbor_offsets,
+    std::vector<uint32_t> & neighbors,
+    std::vector<uint32_t> & neighbor_weights,
+    std::vector<uint64_t> & neighbor_observables)
+{
+    uint32_t num_nodes = perm.to_original.size();
+    std::vector<uint32_t> offsets(num_nodes + 1);
+    std::vector<uint32_t> nbrs(neighbors.size());
+    std::vector<uint32_t> weights(neighbor_weights.size());
+    std::vector<uint64_t> observables(neighbor_observables.size());
+
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        uint32_t node = perm.to_original[i];
+        offsets[i] = slot;
+        for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++, slot++) {
+            nbrs[slot] = neighbors[e] == BOUNDARY ? BOUNDARY : perm.to_internal[neighbors[e]];
+            weights[slot] = neighbor_weights[e];
+            observables[slot] = neighbor_observables[e];
+        }
+    }
+    offsets[num_nodes] = slot;
+
+    neighbor_offsets.swap(offsets);
+    neighbors.swap(nbrs);
+    neighbor_weights.swap(weights);
+    neighbor_observables.swap(observables);
+}
+
+void csr_bandwidth(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, uint32_t & max_distance, double & mean_distance) {
+    uint64_t total = 0;
+    uint64_t count = 0;
+    max_distance = 0;
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        for (uint32_t e = neighbor_offsets[n]; e < neighbor_offsets[n + 1]; e++) {
+            if (neighbors[e] == BOUNDARY) {
+                continue;
+            }
+            uint32_t distance = neighbors[e] > n ? neighbors[e] - n : n - neighbors[e];
+            max_distance = std::max(max_distance, distance);
+            total += distance;
+            count++;
+        }
+    }
+    mean_distance = count ? (double) total / count : 0;
+}
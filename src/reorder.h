@@ -0,0 +1,49 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Relabelling of the nodes of a CSR graph (next_event.h) for memory locality.
+// External ids (detector ids of a DEM, query nodes of a caller) stay as they
+// were; the graph and every per-node array are stored in internal order, and
+// the two maps translate at the edges.
+struct node_permutation {
+    // original id -> internal id
+    std::vector<uint32_t> to_internal;
+    // internal id -> original id
+    std::vector<uint32_t> to_original;
+};
+
+void identity_permutation(uint32_t num_nodes, node_permutation & perm);
+
+// Reverse Cuthill-McKee: a breadth-first walk of each connected component from
+// its lowest-degree node, visiting neighbors by increasing degree, reversed.
+// Neighbors of a node end up close in id, so their entries of the per-node
+// arrays share cache lines and bursts.
+void reverse_cuthill_mckee(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, node_permutation & perm);
+
+// Rewrites the CSR arrays in internal order. The edges of a node keep their
+// order, so the neighbor index a query returns is the same in both orders and
+// needs no translation; only neighbor ids are renamed (-1 stays the boundary).
+void permute_csr(const node_permutation & perm,
+    std::vector<uint32_t> & neighbor_offsets,
+    std::vector<uint32_t> & neighbors,
+    std::vector<uint32_t> & neighbor_weights,
+    std::vector<uint64_t> & neighbor_observables);
+
+// values[original id] -> values[internal id]
+template <class T>
+void permute_nodes(const node_permutation & perm, std::vector<T> & values) {
+    std::vector<T> permuted(values.size());
+    for (size_t n = 0; n < values.size(); n++) {
+        permuted[perm.to_internal[n]] = values[n];
+    }
+    values.swap(permuted);
+}
+
+// Largest and mean |node - neighbor| over all non-boundary edges
+void csr_bandwidth(uint32_t num_nodes, const uint32_t * neighbor_offsets, const uint32_t * neighbors, uint32_t & max_distance, double & mean_distance);
+
+#endif
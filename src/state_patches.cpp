@@ -0,0 +1,174 @@
+#include "state_patches.h"
+#include <algorithm>
+
+state_patches::state_patches(uint64_t * radius, uint32_t * region_that_arrived_top, uint32_t * wrapped_radius_cached,
+    uint32_t num_nodes, uint32_t num_regions)
+    : radius(radius),
+      region_that_arrived_top(region_that_arrived_top),
+      wrapped_radius_cached(wrapped_radius_cached),
+      radius_slot(num_regions, -1),
+      region_that_arrived_top_slot(num_nodes, -1),
+      wrapped_radius_cached_slot(num_nodes, -1),
+      node_states(NULL),
+      region_index(false),
+      cache(NULL),
+      max_radius(0),
+      max_wrapped_radius_cached(0) {
+    for (uint32_t r = 0; r < num_regions; r++) {
+        max_radius = std::max(max_radius, radius[r]);
+    }
+    for (uint32_t n = 0; n < num_nodes; n++) {
+        max_wrapped_radius_cached = std::max(max_wrapped_radius_cached, wrapped_radius_cached[n]);
+    }
+}
+
+static void record(std::vector<uint64_t> & words, std::vector<int32_t> & slots, uint32_t target, uint32_t index, uint64_t value) {
+    if (slots[index] == -1) {
+        slots[index] = words.size();
+        words.push_back(((uint64_t) target << 32) | index);
+        words.push_back(value);
+    } else {
+        words[slots[index] + 1] = value;
+    }
+}
+
+void state_patches::index_regions() {
+    if (region_index) {
+        return;
+    }
+    uint32_t num_nodes = region_that_arrived_top_slot.size();
+    region_index = true;
+    region_nodes.assign(radius_slot.size(), std::vector<uint32_t>());
+    region_nodes_slot.assign(num_nodes, 0);
+    for (uint32_t node = 0; node < num_nodes; node++) {
+        add_region_node(node);
+    }
+}
+
+void state_patches::attach_node_states(node_state * records) {
+    uint32_t num_nodes = region_that_arrived_top_slot.size();
+    node_states = records;
+    pack_node_states(num_nodes, region_that_arrived_top, wrapped_radius_cached, radius, node_states);
+    node_radius_slot.assign(num_nodes, -1);
+    node_region_slot.assign(num_nodes, -1);
+    index_regions();
+}
+
+void state_patches::attach_cache(event_cache * events) {
+    cache = events;
+    index_regions();
+}
+
+void state_patches::region_frontier(uint32_t region, const uint32_t * neighbor_offsets, const uint32_t * neighbors,
+    std::vector<uint32_t> & frontier) const {
+    frontier.clear();
+    const std::vector<uint32_t> & nodes = region_nodes[region];
+    for (size_t i = 0; i < nodes.size(); i++) {
+        uint32_t node = nodes[i];
+        for (uint32_t e = neighbor_offsets[node]; e < neighbor_offsets[node + 1]; e++) {
+            if (neighbors[e] == (uint32_t) -1 || region_that_arrived_top[neighbors[e]] != region) {
+                frontier.push_back(node);
+                break;
+            }
+        }
+    }
+}
+
+void state_patches::add_region_node(uint32_t node) {
+    uint32_t region = region_that_arrived_top[node];
+    if (region != (uint32_t) -1) {
+        region_nodes_slot[node] = region_nodes[region].size();
+        region_nodes[region].push_back(node);
+    }
+}
+
+void state_patches::remove_region_node(uint32_t node) {
+    uint32_t region = region_that_arrived_top[node];
+    if (region != (uint32_t) -1) {
+        std::vector<uint32_t> & nodes = region_nodes[region];
+        uint32_t last = nodes.back();
+        nodes[region_nodes_slot[node]] = last;
+        region_nodes_slot[last] = region_nodes_slot[node];
+        nodes.pop_back();
+    }
+}
+
+void state_patches::refresh_node_state(uint32_t node) {
+    node_state state = resolve_node_state(node, region_that_arrived_top, wrapped_radius_cached, radius);
+    if (state.radius != node_states[node].radius) {
+        record(words, node_radius_slot, PATCH_NODE_RADIUS, node, state.radius);
+    }
+    if (state.region != node_states[node].region) {
+        record(words, node_region_slot, PATCH_NODE_REGION, node, state.region);
+    }
+    node_states[node] = state;
+}
+
+void state_patches::set_radius(uint32_t region, uint64_t value) {
+    radius[region] = value;
+    max_radius = std::max(max_radius, value);
+    if (cache != NULL) {
+        const std::vector<uint32_t> & nodes = region_nodes[region];
+        for (size_t i = 0; i < nodes.size(); i++) {
+            cache->invalidate(nodes[i]);
+        }
+    }
+    if (node_states == NULL) {
+        record(words, radius_slot, PATCH_RADIUS, region, value);
+        return;
+    }
+    const std::vector<uint32_t> & nodes = region_nodes[region];
+    for (size_t i = 0; i < nodes.size(); i++) {
+        refresh_node_state(nodes[i]);
+    }
+}
+
+void state_patches::set_region_that_arrived_top(uint32_t node, uint32_t region) {
+    if (cache != NULL) {
+        cache->invalidate(node);
+    }
+    if (region_index) {
+        remove_region_node(node);
+    }
+    region_that_arrived_top[node] = region;
+    if (region_index) {
+        add_region_node(node);
+    }
+    if (node_states == NULL) {
+        record(words, region_that_arrived_top_slot, PATCH_REGION_THAT_ARRIVED_TOP, node, region);
+        return;
+    }
+    refresh_node_state(node);
+}
+
+void state_patches::set_wrapped_radius_cached(uint32_t node, uint32_t value) {
+    wrapped_radius_cached[node] = value;
+    max_wrapped_radius_cached = std::max(max_wrapped_radius_cached, value);
+    if (cache != NULL) {
+        cache->invalidate(node);
+    }
+    if (node_states == NULL) {
+        record(words, wrapped_radius_cached_slot, PATCH_WRAPPED_RADIUS_CACHED, node, value);
+        return;
+    }
+    refresh_node_state(node);
+}
+
+void state_patches::clear() {
+    for (size_t p = 0; p < words.size(); p += 2) {
+        uint32_t target = words[p] >> 32;
+        uint32_t index = (uint32_t) words[p];
+        if (target == PATCH_RADIUS) {
+            radius_slot[index] = -1;
+        } else if (target == PATCH_REGION_THAT_ARRIVED_TOP) {
+            region_that_arrived_top_slot[index] = -1;
+        } else if (target == PATCH_WRAPPED_RADIUS_CACHED) {
+            wrapped_radius_cached_slot[index] = -1;
+        } else if (target == PATCH_NODE_RADIUS) {
+            node_radius_slot[index] = -1;
+        } else {
+            node_region_slot[index] = -1;
+        }
+    }
+    words.clear();
+}
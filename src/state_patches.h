@@ -0,0 +1,86 @@
+#ifndef STATE_PATCHES_H
+#define STATE_PATCHES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "querk_params.h"
+#include "next_event.h"
+#include "event_cache.h"
+
+// Host mirror of the dynamic arrays (radius, region_that_arrived_top,
+// wrapped_radius_cached). Every write lands in the host copy and is recorded
+// as a patch, so only the entries that changed since the last flush have to
+// cross PCIe before the next batch of queries. Writing the same entry twice
+// before a flush overwrites the pending patch instead of adding a new one.
+struct state_patches {
+    uint64_t * radius;
+    uint32_t * region_that_arrived_top;
+    uint32_t * wrapped_radius_cached;
+
+    // two words per patch, laid out as the kernel reads them:
+    // (target << 32 | index), value
+    std::vector<uint64_t> words;
+
+    // position of the pending patch for every entry, -1 when the entry is clean
+    std::vector<int32_t> radius_slot;
+    std::vector<int32_t> region_that_arrived_top_slot;
+    std::vector<int32_t> wrapped_radius_cached_slot;
+
+    // Packed layout, NULL unless attach_node_states() was called. Every write
+    // then re-resolves the records it affects (all nodes of the region for a
+    // radius change) and only the record fields that changed are shipped, as
+    // PATCH_NODE_RADIUS / PATCH_NODE_REGION; the three arrays are still kept
+    // current on the host but no longer patched on the device.
+    node_state * node_states;
+    // nodes by region_that_arrived_top, and each node's position in its list;
+    // only kept once node_states or cache needs it
+    bool region_index;
+    std::vector<std::vector<uint32_t> > region_nodes;
+    std::vector<uint32_t> region_nodes_slot;
+    std::vector<int32_t> node_radius_slot;
+    std::vector<int32_t> node_region_slot;
+
+    // NULL unless attach_cache() was called; every write then invalidates the
+    // cached events of the nodes whose neighborhood it touched
+    event_cache * cache;
+
+    // largest radius word and wrapped_radius_cached ever written, for the
+    // datapath width (time_bits_for in next_event.h)
+    uint64_t max_radius;
+    uint32_t max_wrapped_radius_cached;
+
+    state_patches(uint64_t * radius, uint32_t * region_that_arrived_top, uint32_t * wrapped_radius_cached,
+        uint32_t num_nodes, uint32_t num_regions);
+
+    void set_radius(uint32_t region, uint64_t value);
+    void set_region_that_arrived_top(uint32_t node, uint32_t region);
+    void set_wrapped_radius_cached(uint32_t node, uint32_t value);
+
+    // Fills node_states (num_nodes records) from the arrays and keeps it current from now on.
+    void attach_node_states(node_state * node_states);
+    // Invalidates cache entries from now on. The cache must start out empty
+    // or hold results for the arrays as they are now.
+    void attach_cache(event_cache * cache);
+
+    // The nodes of a region that can have an event: those with a boundary
+    // edge or a neighbor outside the region. A node whose neighbors are all
+    // in its own region has none, so a region's earliest event is the minimum
+    // over its frontier (backend::query_min). Needs the region index, which
+    // either attach call builds.
+    void region_frontier(uint32_t region, const uint32_t * neighbor_offsets, const uint32_t * neighbors,
+        std::vector<uint32_t> & frontier) const;
+
+    uint32_t size() const { return words.size() / 2; }
+    // bounds every local radius the arrays have held
+    uint64_t local_radius_bound() const { return max_radius + ((uint64_t) max_wrapped_radius_cached << 2); }
+    // forget the pending patches once they have been shipped (or superseded by a full upload)
+    void clear();
+
+    void index_regions();
+    void refresh_node_state(uint32_t node);
+    void add_region_node(uint32_t node);
+    void remove_region_node(uint32_t node);
+};
+
+#endif